@@ -1,4 +1,22 @@
 #include "algorithms.h"
+#include "helper.h"
+
+#include <atomic>
+#include <cstdint>
+#include <climits>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <sstream>
+
+//AVX2 ray marching and extent reduction, selected at runtime on CPUs that support it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SWT_AVX2 1
+#include <immintrin.h>
+#else
+#define SWT_AVX2 0
+#endif
 
 //===============================================================================
 // compute_grayscale()
@@ -92,6 +110,665 @@ void algorithms::compute_directions(const cv::Mat &gradient_x, const cv::Mat &gr
     }
 }
 
+//a few stripes per thread, so uneven work is balanced
+static int swt_num_stripes(const size_t items)
+{
+    if (cv::getNumThreads() > 1) {
+        return (int)std::max((size_t)1, std::min(items, (size_t)cv::getNumThreads() * 4));
+    }
+    return 1;
+}
+
+//===============================================================================
+// extract_edge_pixels()
+//-------------------------------------------------------------------------------
+// Compacts the Canny map into a list of the edge pixels with their gradient
+// direction, in row-major order. Rows are read eight pixels at a time and words
+// without any edge are skipped, since only a few percent of the pixels are
+// edges. Pixels with a zero direction are left out, a ray from them never
+// moves. Row stripes are compacted in parallel and concatenated in order.
+//
+// parameters:
+//  - edges: [CV_8UC1] matrix filled with the Canny-edges
+//  - direction_x: [CV_32FC1] matrix of the gradient direction in x direction
+//  - direction_y: [CV_32FC1] matrix of the gradient direction in y direction
+//  - edge_pixels: output list of the edge pixels
+// return: void
+//===============================================================================
+void algorithms::extract_edge_pixels(const cv::Mat &edges, const cv::Mat &direction_x, const cv::Mat &direction_y,
+                                     EdgeList &edge_pixels)
+{
+    const int num_stripes = swt_num_stripes(edges.rows);
+    std::vector<EdgeList> stripe_pixels(num_stripes);
+
+    cv::parallel_for_(cv::Range(0, num_stripes), [&](const cv::Range &range) {
+        for (int stripe = range.start; stripe < range.end; stripe++) {
+            int row_begin = (int)((long long)edges.rows * stripe / num_stripes);
+            int row_end = (int)((long long)edges.rows * (stripe + 1) / num_stripes);
+            EdgeList &pixels = stripe_pixels[stripe];
+
+            for (int i = row_begin; i < row_end; i++) {
+                const unsigned char *edge_row = edges.ptr<unsigned char>(i);
+                const float *direction_x_row = direction_x.ptr<float>(i);
+                const float *direction_y_row = direction_y.ptr<float>(i);
+
+                int j = 0;
+                while (j < edges.cols) {
+                    //skip eight pixels without an edge at once
+                    if (j + 8 <= edges.cols) {
+                        uint64_t word;
+                        std::memcpy(&word, edge_row + j, sizeof(word));
+                        if (word == 0) {
+                            j += 8;
+                            continue;
+                        }
+                    }
+                    int word_end = std::min(j + 8, edges.cols);
+                    for (; j < word_end; j++) {
+                        if ((edge_row[j] == 255) && ((direction_x_row[j] != 0) || (direction_y_row[j] != 0))) {
+                            EdgePixel pixel;
+                            pixel.position = cv::Point2i(j, i);
+                            pixel.gradient = cv::Point2f(direction_x_row[j], direction_y_row[j]);
+                            pixels.push_back(pixel);
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    edge_pixels.clear();
+    for (auto &pixels : stripe_pixels) {
+        edge_pixels.insert(edge_pixels.end(), pixels.begin(), pixels.end());
+    }
+}
+
+//===============================================================================
+// RayMarcher
+//-------------------------------------------------------------------------------
+// Walks the pixels of a SWT ray, exactly one new pixel per call of next().
+// The pixel at step s is floor(start + direction * s) evaluated in float, the
+// same rule the original step loop used, so the pixel sequence is unchanged.
+// Steps which stay on the current pixel are skipped inside next() without any
+// bounds or edge checks, and the floor is done inline instead of through libm.
+//===============================================================================
+class RayMarcher
+{
+   public:
+    RayMarcher(const cv::Point2i &start, const cv::Point2f &direction)
+        : pixel(start), start_(start), direction_(direction), step_(0)
+    {
+    }
+
+    // moves to the next pixel of the ray, false if the ray never leaves its start pixel
+    bool next()
+    {
+        if ((direction_.x == 0) && (direction_.y == 0)) {
+            return false;
+        }
+        while (true) {
+            step_++;
+            int x = floor_int(start_.x + direction_.x * step_);
+            int y = floor_int(start_.y + direction_.y * step_);
+            if ((x != pixel.x) || (y != pixel.y)) {
+                pixel = cv::Point2i(x, y);
+                return true;
+            }
+        }
+    }
+
+    cv::Point2i pixel;
+
+   private:
+    static int floor_int(const float value)
+    {
+        int result = (int)value;
+        return (result > value) ? result - 1 : result;
+    }
+
+    cv::Point2i start_;
+    cv::Point2f direction_;
+    int step_;
+};
+
+//cosine of the maximum angle between the gradients at both ends of a ray
+static const double swt_min_opposite_cos = cos(CV_PI / 6);
+
+//===============================================================================
+// swt_march_ray()
+//-------------------------------------------------------------------------------
+// Marches a single ray from an edge pixel until it leaves the image, gets
+// longer than the limit or hits another edge pixel. The polarity is a template
+// parameter, Direction is -1 for black on white and 1 for white on black.
+//
+// parameters:
+//  - edges: [CV_8UC1] matrix filled with the Canny-edges
+//  - direction_x: [CV_32FC1] matrix of the gradient direction in x direction
+//  - direction_y: [CV_32FC1] matrix of the gradient direction in y direction
+//  - start: edge pixel the ray starts from
+//  - gradient: gradient direction at the start pixel
+//  - max_ray_length: maximum number of ray pixels, 0 means unlimited
+//  - ray: output ray, only valid if the ray is accepted
+//  - steps: number of marched pixels is added here
+// return: true if the ray is accepted
+//===============================================================================
+template <int Direction>
+static bool swt_march_ray(const cv::Mat &edges, const cv::Mat &direction_x, const cv::Mat &direction_y,
+                          const cv::Point2i &start, const cv::Point2f &gradient, const int max_ray_length,
+                          algorithms::Ray &ray, long long &steps)
+{
+    cv::Point2f ray_direction(gradient.x * Direction, gradient.y * Direction);
+    RayMarcher marcher(start, ray_direction);
+    int length = 1;
+    bool accepted = false;
+
+    //march until the ray leaves the image or hits another edge pixel
+    while (marcher.next()) {
+        const cv::Point2i &current = marcher.pixel;
+        if ((current.x < 0) || (current.y < 0) || (current.y >= edges.rows) || (current.x >= edges.cols)) {
+            break;
+        }
+        length++;
+        //too wide to be a stroke
+        if ((max_ray_length > 0) && (length > max_ray_length)) {
+            break;
+        }
+
+        if (edges.at<unsigned char>(current) == 255) {
+            //the ray is valid if the gradient at its end points roughly the other way
+            auto curr_dir_x = direction_x.at<float>(current);
+            auto curr_dir_y = direction_y.at<float>(current);
+
+            double dotp = ((gradient.x * curr_dir_x) +(gradient.y * curr_dir_y)) *(double)(-1);
+            if (dotp >= swt_min_opposite_cos) {
+                ray.start = start;
+                ray.end = current;
+                ray.direction = ray_direction;
+                ray.length = length;
+                accepted = true;
+            }
+            break;
+        }
+    }
+    steps += length - 1;
+    return accepted;
+}
+
+//===============================================================================
+// swt_march_block()
+//-------------------------------------------------------------------------------
+// Marches the rays of one polarity for the edge pixels [first, last) with
+// swt_march_ray(). Results are stored per edge pixel, so the caller can append
+// the accepted rays in the order of the edge list. Direction is -1 for black
+// on white and 1 for white on black.
+//
+// parameters:
+//  - edges, direction_x, direction_y, edge_pixels, first, last: see swt_cast_rays()
+//  - max_ray_length: maximum number of ray pixels, 0 means unlimited
+//  - rays: output array with one ray per edge pixel, only valid if accepted
+//  - accepted: output array with one flag per edge pixel
+//  - steps: number of marched pixels is added here
+// return: void
+//===============================================================================
+template <int Direction>
+static void swt_march_block(const cv::Mat &edges, const cv::Mat &direction_x, const cv::Mat &direction_y,
+                            const algorithms::EdgeList &edge_pixels, const size_t first, const size_t last,
+                            const int max_ray_length, algorithms::Ray *rays, bool *accepted, long long &steps)
+{
+    for (size_t k = first; k < last; k++) {
+        accepted[k - first] = swt_march_ray<Direction>(edges, direction_x, direction_y, edge_pixels[k].position,
+                                                       edge_pixels[k].gradient, max_ray_length, rays[k - first],
+                                                       steps);
+    }
+}
+
+#if SWT_AVX2
+//===============================================================================
+// swt_march_block_avx2()
+//-------------------------------------------------------------------------------
+// AVX2 version of swt_march_block(). Eight rays are marched in lockstep, one
+// per lane. Every lane does the same float operations in the same order as
+// RayMarcher and swt_march_ray() (no fused multiply-add), so the results are
+// bit-for-bit the same. The edge map and the direction planes are read with
+// masked gathers. A lane whose ray terminated is refilled with the next edge
+// pixel right away, which keeps the lanes busy without sorting the pixels.
+//===============================================================================
+__attribute__((target("avx2"))) static void swt_march_block_avx2(
+    const cv::Mat &edges, const cv::Mat &direction_x, const cv::Mat &direction_y,
+    const algorithms::EdgeList &edge_pixels, const size_t first, const size_t last, const int8_t direction,
+    const int max_ray_length, algorithms::Ray *rays, bool *accepted, long long &steps)
+{
+    //-(double)dot >= cos(pi/6) on a float dot product is dot <= threshold in float
+    float threshold = (float)(-swt_min_opposite_cos);
+    if ((double)threshold > -swt_min_opposite_cos) {
+        threshold = std::nextafter(threshold, -FLT_MAX);
+    }
+
+    const unsigned char *edge_data = edges.ptr<unsigned char>(0);
+    const float *direction_x_data = direction_x.ptr<float>(0);
+    const float *direction_y_data = direction_y.ptr<float>(0);
+    const __m256i edge_stride = _mm256_set1_epi32((int)(size_t)edges.step);
+    const __m256i direction_x_stride = _mm256_set1_epi32((int)((size_t)direction_x.step / sizeof(float)));
+    const __m256i direction_y_stride = _mm256_set1_epi32((int)((size_t)direction_y.step / sizeof(float)));
+    const __m256i cols = _mm256_set1_epi32(edges.cols);
+    const __m256i rows = _mm256_set1_epi32(edges.rows);
+    const __m256i max_length = _mm256_set1_epi32((max_ray_length > 0) ? max_ray_length : INT_MAX);
+    const __m256i ones = _mm256_set1_epi32(1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256 sign = _mm256_set1_ps((float)direction);
+    const __m256 threshold_ps = _mm256_set1_ps(threshold);
+
+    //lane state, spilled to memory only when lanes are refilled
+    alignas(32) int lane_index[8];
+    alignas(32) int lane_start_x[8], lane_start_y[8], lane_step[8], lane_x[8], lane_y[8], lane_length[8];
+    alignas(32) float lane_gradient_x[8], lane_gradient_y[8];
+
+    size_t next = first;
+    int active = 0;
+    for (int lane = 0; lane < 8; lane++) {
+        lane_index[lane] = -1;
+        lane_start_x[lane] = lane_start_y[lane] = lane_x[lane] = lane_y[lane] = 0;
+        lane_step[lane] = 0;
+        lane_length[lane] = 1;
+        lane_gradient_x[lane] = lane_gradient_y[lane] = 0;
+        if (next < last) {
+            const algorithms::EdgePixel &pixel = edge_pixels[next];
+            lane_index[lane] = (int)(next - first);
+            lane_start_x[lane] = lane_x[lane] = pixel.position.x;
+            lane_start_y[lane] = lane_y[lane] = pixel.position.y;
+            lane_gradient_x[lane] = pixel.gradient.x;
+            lane_gradient_y[lane] = pixel.gradient.y;
+            active |= 1 << lane;
+            next++;
+        }
+    }
+
+    while (active != 0) {
+        __m256i start_x = _mm256_load_si256((const __m256i *)lane_start_x);
+        __m256i start_y = _mm256_load_si256((const __m256i *)lane_start_y);
+        __m256 start_x_ps = _mm256_cvtepi32_ps(start_x);
+        __m256 start_y_ps = _mm256_cvtepi32_ps(start_y);
+        __m256 gradient_x = _mm256_load_ps(lane_gradient_x);
+        __m256 gradient_y = _mm256_load_ps(lane_gradient_y);
+        __m256 ray_x = _mm256_mul_ps(gradient_x, sign);
+        __m256 ray_y = _mm256_mul_ps(gradient_y, sign);
+        __m256i step = _mm256_load_si256((const __m256i *)lane_step);
+        __m256i x = _mm256_load_si256((const __m256i *)lane_x);
+        __m256i y = _mm256_load_si256((const __m256i *)lane_y);
+        __m256i length = _mm256_load_si256((const __m256i *)lane_length);
+        __m256i live = _mm256_cmpgt_epi32(_mm256_and_si256(_mm256_set1_epi32(active), _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128)), zero);
+
+        int finished = 0;
+        int hits_accepted = 0;
+        while (finished == 0) {
+            //next step of RayMarcher::next(): floor(start + direction * step) in float
+            step = _mm256_add_epi32(step, ones);
+            __m256 step_ps = _mm256_cvtepi32_ps(step);
+            __m256i next_x = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(start_x_ps, _mm256_mul_ps(ray_x, step_ps))));
+            __m256i next_y = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(start_y_ps, _mm256_mul_ps(ray_y, step_ps))));
+            __m256i same = _mm256_and_si256(_mm256_cmpeq_epi32(next_x, x), _mm256_cmpeq_epi32(next_y, y));
+            __m256i moved = _mm256_andnot_si256(same, live);
+            if (_mm256_testz_si256(moved, moved)) {
+                continue;
+            }
+            x = _mm256_blendv_epi8(x, next_x, moved);
+            y = _mm256_blendv_epi8(y, next_y, moved);
+
+            //left the image
+            __m256i minus_one = _mm256_set1_epi32(-1);
+            __m256i in_image = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(x, minus_one), _mm256_cmpgt_epi32(y, minus_one)),
+                                                _mm256_and_si256(_mm256_cmpgt_epi32(cols, x), _mm256_cmpgt_epi32(rows, y)));
+            __m256i outside = _mm256_andnot_si256(in_image, moved);
+            __m256i inside = _mm256_andnot_si256(outside, moved);
+            length = _mm256_sub_epi32(length, inside);
+
+            //too wide to be a stroke
+            __m256i too_long = _mm256_and_si256(_mm256_cmpgt_epi32(length, max_length), inside);
+            __m256i check = _mm256_andnot_si256(too_long, inside);
+
+            //edge pixel reached, read the aligned word holding the byte
+            __m256i edge_offset = _mm256_add_epi32(_mm256_mullo_epi32(y, edge_stride), x);
+            __m256i edge_word = _mm256_mask_i32gather_epi32(zero, (const int *)edge_data,
+                                                            _mm256_andnot_si256(_mm256_set1_epi32(3), edge_offset),
+                                                            check, 1);
+            __m256i edge_shift = _mm256_slli_epi32(_mm256_and_si256(edge_offset, _mm256_set1_epi32(3)), 3);
+            __m256i edge_value = _mm256_and_si256(_mm256_srlv_epi32(edge_word, edge_shift), _mm256_set1_epi32(0xFF));
+            __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi32(edge_value, _mm256_set1_epi32(255)), check);
+
+            //the ray is valid if the gradient at its end points roughly the other way
+            int hit_mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+            if (hit_mask != 0) {
+                __m256 end_x = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), direction_x_data,
+                                                        _mm256_add_epi32(_mm256_mullo_epi32(y, direction_x_stride), x),
+                                                        _mm256_castsi256_ps(hit), 4);
+                __m256 end_y = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), direction_y_data,
+                                                        _mm256_add_epi32(_mm256_mullo_epi32(y, direction_y_stride), x),
+                                                        _mm256_castsi256_ps(hit), 4);
+                __m256 dot = _mm256_add_ps(_mm256_mul_ps(gradient_x, end_x), _mm256_mul_ps(gradient_y, end_y));
+                hits_accepted = _mm256_movemask_ps(_mm256_cmp_ps(dot, threshold_ps, _CMP_LE_OQ)) & hit_mask;
+            }
+
+            finished = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_or_si256(outside, too_long), hit)));
+        }
+
+        _mm256_store_si256((__m256i *)lane_step, step);
+        _mm256_store_si256((__m256i *)lane_x, x);
+        _mm256_store_si256((__m256i *)lane_y, y);
+        _mm256_store_si256((__m256i *)lane_length, length);
+
+        //store the terminated rays and refill their lanes
+        for (int lane = 0; lane < 8; lane++) {
+            if ((finished & (1 << lane)) == 0) {
+                continue;
+            }
+            int index = lane_index[lane];
+            accepted[index] = (hits_accepted & (1 << lane)) != 0;
+            if (accepted[index]) {
+                algorithms::Ray &ray = rays[index];
+                ray.start = cv::Point2i(lane_start_x[lane], lane_start_y[lane]);
+                ray.end = cv::Point2i(lane_x[lane], lane_y[lane]);
+                ray.direction = cv::Point2f(lane_gradient_x[lane] * direction, lane_gradient_y[lane] * direction);
+                ray.length = lane_length[lane];
+            }
+            steps += lane_length[lane] - 1;
+
+            if (next < last) {
+                const algorithms::EdgePixel &pixel = edge_pixels[next];
+                lane_index[lane] = (int)(next - first);
+                lane_start_x[lane] = lane_x[lane] = pixel.position.x;
+                lane_start_y[lane] = lane_y[lane] = pixel.position.y;
+                lane_gradient_x[lane] = pixel.gradient.x;
+                lane_gradient_y[lane] = pixel.gradient.y;
+                lane_step[lane] = 0;
+                lane_length[lane] = 1;
+                next++;
+            } else {
+                active &= ~(1 << lane);
+            }
+        }
+    }
+}
+#endif
+
+static std::atomic<bool> swt_vectorized_enabled(true);
+
+//===============================================================================
+// swt_set_vectorized()
+//-------------------------------------------------------------------------------
+// Switches the AVX2 ray marching on or off, e.g. to compare it against the
+// scalar version. It is on by default and only used if the CPU supports it.
+//===============================================================================
+void algorithms::swt_set_vectorized(const bool enabled)
+{
+    swt_vectorized_enabled = enabled;
+}
+
+//===============================================================================
+// swt_vectorized()
+//-------------------------------------------------------------------------------
+// return: true if the SWT marches its rays with AVX2
+//===============================================================================
+bool algorithms::swt_vectorized()
+{
+#if SWT_AVX2
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported && swt_vectorized_enabled;
+#else
+    return false;
+#endif
+}
+
+//===============================================================================
+// swt_cast_rays()
+//-------------------------------------------------------------------------------
+// Casts the rays of the edge pixels [first, last) of the edge list and keeps
+// the accepted rays, for one or both polarities in the same pass. Only start,
+// end, direction and length of a ray are stored, its pixels are re-marched by
+// swt_ray_pixels() when they are needed. The SWT image is not touched here, so
+// several parts of the list can be processed at the same time.
+//
+// parameters:
+//  - edges: [CV_8UC1] matrix filled with the Canny-edges
+//  - direction_x: [CV_32FC1] matrix of the gradient direction in x direction
+//  - direction_y: [CV_32FC1] matrix of the gradient direction in y direction
+//  - edge_pixels: list of the edge pixels from extract_edge_pixels()
+//  - first, last: range of the edge pixels to start rays from
+//  - limits: maximum ray length and per image budgets
+//  - total_rays, total_steps: per image counters shared by all parts
+//  - black_on_white_rays: output list of the rays against the gradient, nullptr to skip them
+//  - white_on_black_rays: output list of the rays along the gradient, nullptr to skip them
+// return: false if a budget of the image was exceeded
+//===============================================================================
+static bool swt_cast_rays(const cv::Mat &edges, const cv::Mat &direction_x, const cv::Mat &direction_y,
+                          const algorithms::EdgeList &edge_pixels, const size_t first, const size_t last,
+                          const algorithms::SwtLimits &limits, std::atomic<long long> &total_rays,
+                          std::atomic<long long> &total_steps, algorithms::RayList *black_on_white_rays,
+                          algorithms::RayList *white_on_black_rays)
+{
+    //budgets are checked after each block against the sum of all parts
+    const size_t block_size = 256;
+
+    //the gathers read the aligned word around an edge byte with 32 bit offsets
+    const bool vectorized = algorithms::swt_vectorized() && ((reinterpret_cast<uintptr_t>(edges.data) & 3) == 0) &&
+                            ((size_t)edges.step * edges.rows < (size_t)INT_MAX);
+
+    std::vector<algorithms::Ray> rays(block_size);
+    bool accepted[block_size];
+    algorithms::RayList *polarity_rays[2] = {black_on_white_rays, white_on_black_rays};
+    const int8_t polarity_direction[2] = {-1, 1};
+
+    for (size_t block = first; block < last; block += block_size) {
+        size_t block_end = std::min(block + block_size, last);
+        long long block_rays = 0;
+        long long block_steps = 0;
+
+        for (int polarity = 0; polarity < 2; polarity++) {
+            if (polarity_rays[polarity] == nullptr) {
+                continue;
+            }
+#if SWT_AVX2
+            if (vectorized) {
+                swt_march_block_avx2(edges, direction_x, direction_y, edge_pixels, block, block_end,
+                                     polarity_direction[polarity], limits.max_ray_length, rays.data(), accepted,
+                                     block_steps);
+            } else
+#endif
+            if (polarity == 0) {
+                swt_march_block<-1>(edges, direction_x, direction_y, edge_pixels, block, block_end,
+                                    limits.max_ray_length, rays.data(), accepted, block_steps);
+            } else {
+                swt_march_block<1>(edges, direction_x, direction_y, edge_pixels, block, block_end,
+                                   limits.max_ray_length, rays.data(), accepted, block_steps);
+            }
+            for (size_t k = 0; k < block_end - block; k++) {
+                if (accepted[k]) {
+                    polarity_rays[polarity]->push_back(rays[k]);
+                    block_rays++;
+                }
+            }
+        }
+
+        long long image_rays = (total_rays += block_rays);
+        long long image_steps = (total_steps += block_steps);
+        if (((limits.max_rays > 0) && (image_rays > limits.max_rays)) ||
+            ((limits.max_ray_steps > 0) && (image_steps > limits.max_ray_steps))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//===============================================================================
+// swt_ray_pixels()
+//-------------------------------------------------------------------------------
+// Re-marches a ray with the same rasterisation rule as swt_compute_stroke_width.
+//
+// parameters:
+//  - ray: the ray to walk
+//  - pixels: output vector with the ray pixels from start to end (x = col, y = row)
+// return: void
+//===============================================================================
+void algorithms::swt_ray_pixels(const Ray &ray, std::vector<cv::Point2i> &pixels)
+{
+    pixels.clear();
+    pixels.push_back(ray.start);
+
+    RayMarcher marcher(ray.start, ray.direction);
+    while (((int)pixels.size() < ray.length) && marcher.next()) {
+        pixels.push_back(marcher.pixel);
+    }
+}
+
+//===============================================================================
+// swt_cast_stripes()
+//-------------------------------------------------------------------------------
+// Extracts the edge pixels and casts their rays in parallel parts of the edge
+// list (cv::parallel_for_, cv::setNumThreads() picks the thread count). The
+// parts hold the same number of edge pixels and their rays are concatenated in
+// order, so the lists are the same as with a single thread.
+//
+// parameters:
+//  - see swt_cast_rays(), throws std::runtime_error if a budget is exceeded
+// return: void
+//===============================================================================
+static void swt_cast_stripes(const cv::Mat &edges, const cv::Mat &direction_x, const cv::Mat &direction_y,
+                             const algorithms::SwtLimits &limits, algorithms::RayList *black_on_white_rays,
+                             algorithms::RayList *white_on_black_rays)
+{
+    algorithms::EdgeList edge_pixels;
+    algorithms::extract_edge_pixels(edges, direction_x, direction_y, edge_pixels);
+
+    const int num_stripes = swt_num_stripes(edge_pixels.size());
+    std::vector<algorithms::RayList> black_on_white_stripes(num_stripes);
+    std::vector<algorithms::RayList> white_on_black_stripes(num_stripes);
+    std::atomic<long long> total_rays(0);
+    std::atomic<long long> total_steps(0);
+    std::atomic<bool> budget_exceeded(false);
+
+    cv::parallel_for_(cv::Range(0, num_stripes), [&](const cv::Range &range) {
+        for (int stripe = range.start; (stripe < range.end) && !budget_exceeded; stripe++) {
+            size_t first = edge_pixels.size() * stripe / num_stripes;
+            size_t last = edge_pixels.size() * (stripe + 1) / num_stripes;
+            if (!swt_cast_rays(edges, direction_x, direction_y, edge_pixels, first, last, limits, total_rays,
+                               total_steps, black_on_white_rays ? &black_on_white_stripes[stripe] : nullptr,
+                               white_on_black_rays ? &white_on_black_stripes[stripe] : nullptr)) {
+                budget_exceeded = true;
+            }
+        }
+    });
+
+    //the counters only grow, so a run exceeds a budget independent of the thread count
+    if (budget_exceeded) {
+        std::stringstream reason;
+        reason << "SWT budget exceeded: ";
+        if ((limits.max_rays > 0) && (total_rays > limits.max_rays)) {
+            reason << "more than " << limits.max_rays << " rays";
+        } else {
+            reason << "more than " << limits.max_ray_steps << " ray steps";
+        }
+        throw std::runtime_error(reason.str());
+    }
+
+    for (int stripe = 0; stripe < num_stripes; stripe++) {
+        if (black_on_white_rays != nullptr) {
+            black_on_white_rays->insert(black_on_white_rays->end(), black_on_white_stripes[stripe].begin(),
+                                        black_on_white_stripes[stripe].end());
+        }
+        if (white_on_black_rays != nullptr) {
+            white_on_black_rays->insert(white_on_black_rays->end(), white_on_black_stripes[stripe].begin(),
+                                        white_on_black_stripes[stripe].end());
+        }
+    }
+}
+
+//===============================================================================
+// swt_stripe_rays()
+//-------------------------------------------------------------------------------
+// Buckets the rays by the row stripes they cross, in one pass over the rays.
+// Every bucket lists its rays in ray order, so a stripe going through its
+// bucket writes overlapping pixels in the same order as a serial run.
+//
+// parameters:
+//  - rays: list of the rays
+//  - rows: number of image rows
+//  - num_stripes: number of row stripes, stripe s starts at row rows * s / num_stripes
+//  - stripe_first: output, the rays of stripe s are at stripe_first[s] to stripe_first[s + 1] - 1
+//  - stripe_rays: output with the ray indices of every stripe
+// return: void
+//===============================================================================
+static void swt_stripe_rays(const algorithms::RayList &rays, const int rows, const int num_stripes,
+                            std::vector<int> &stripe_first, std::vector<int> &stripe_rays)
+{
+    //stripe of a row, the last one starting at or above it
+    auto row_stripe = [rows, num_stripes](const int row) {
+        const int clamped = std::min(std::max(row, 0), rows - 1);
+        return (int)(((long long)(clamped + 1) * num_stripes - 1) / rows);
+    };
+
+    stripe_first.assign(num_stripes + 1, 0);
+    for (const algorithms::Ray &ray : rays) {
+        const int last = row_stripe(std::max(ray.start.y, ray.end.y));
+        for (int stripe = row_stripe(std::min(ray.start.y, ray.end.y)); stripe <= last; stripe++) {
+            stripe_first[stripe + 1]++;
+        }
+    }
+    for (int stripe = 0; stripe < num_stripes; stripe++) {
+        stripe_first[stripe + 1] += stripe_first[stripe];
+    }
+
+    stripe_rays.resize(stripe_first[num_stripes]);
+    std::vector<int> next(stripe_first.begin(), stripe_first.end() - 1);
+    for (size_t i = 0; i < rays.size(); i++) {
+        const int last = row_stripe(std::max(rays[i].start.y, rays[i].end.y));
+        for (int stripe = row_stripe(std::min(rays[i].start.y, rays[i].end.y)); stripe <= last; stripe++) {
+            stripe_rays[next[stripe]++] = (int)i;
+        }
+    }
+}
+
+//===============================================================================
+// swt_assign_widths()
+//-------------------------------------------------------------------------------
+// Writes the stroke width of every ray to its pixels, keeping the minimum.
+// Min does not depend on the order, so every row stripe writes the pixels of
+// its own rows in parallel, going only through the rays that cross it.
+//
+// parameters:
+//  - rays: list of the accepted rays
+//  - swt_stroke_width_image: [CV_32FC1] output matrix, initialized with FLT_MAX
+// return: void
+//===============================================================================
+static void swt_assign_widths(const algorithms::RayList &rays, cv::Mat &swt_stroke_width_image)
+{
+    const int rows = swt_stroke_width_image.rows;
+    const int num_stripes = swt_num_stripes(rows);
+    std::vector<int> stripe_first;
+    std::vector<int> stripe_rays;
+    swt_stripe_rays(rays, rows, num_stripes, stripe_first, stripe_rays);
+
+    cv::parallel_for_(cv::Range(0, num_stripes), [&](const cv::Range &range) {
+        std::vector<cv::Point2i> ray_pixels;
+        for (int stripe = range.start; stripe < range.end; stripe++) {
+            int row_begin = (int)((long long)rows * stripe / num_stripes);
+            int row_end = (int)((long long)rows * (stripe + 1) / num_stripes);
+            for (int k = stripe_first[stripe]; k < stripe_first[stripe + 1]; k++) {
+                const algorithms::Ray &ray = rays[stripe_rays[k]];
+                auto sumx = ray.start.x - ray.end.x;
+                auto sumy = ray.start.y - ray.end.y;
+                float wid = sqrt(pow(sumx,2)+pow(sumy,2));
+
+                algorithms::swt_ray_pixels(ray, ray_pixels);
+                for (auto point : ray_pixels) {
+                    if ((point.y >= row_begin) && (point.y < row_end) &&
+                        (wid < swt_stroke_width_image.at<float>(point))) {
+                        swt_stroke_width_image.at<float>(point) = wid;
+                    }
+                }
+            }
+        }
+    });
+}
+
 //===============================================================================
 // swt_estimate_stroke_width()
 //-------------------------------------------------------------------------------
@@ -104,189 +781,841 @@ void algorithms::compute_directions(const cv::Mat &gradient_x, const cv::Mat &gr
 //       - use the the mathematical functions provided by the standard library
 //         (example: std::floor, std::sqrt, std::pow, etc.)
 //
+// The edge pixels are compacted into a list which is split into parts that cast
+// their rays in parallel (cv::parallel_for_, cv::setNumThreads() picks the
+// thread count). The rays are concatenated in row order and their widths are
+// written with min semantics, so rays and SWT image are the same as with a
+// single thread.
+//
 // parameters:
 //  - edges: [CV_8UC1] matrix filled with the Canny-edges
 //  - direction_x: [CV_32FC1] matrix of the gradient direction in x direction
 //  - direction_y: [CV_32FC1] matrix of the gradient direction in y direction
 //  - black_on_white: bool parameter to decide the direction of the rays
-//  - rays: vector of vectors of points (x = col, y = row)
+//  - limits: maximum ray length and per image budgets of rays and marched pixels,
+//    throws std::runtime_error if a budget is exceeded
+//  - rays: list of the accepted rays (start, end, direction, length)
 //  - swt_estimation_image: [CV_32FC1] output matrix for the stroke widths, initialize with FLT_MAX
 // return: void
 //===============================================================================
 void algorithms::swt_compute_stroke_width(const cv::Mat &edges, const cv::Mat &direction_x, const cv::Mat &direction_y,
-                                          const bool black_on_white, std::vector<std::vector<cv::Point2i>> &rays,
+                                          const bool black_on_white, const SwtLimits &limits, RayList &rays,
                                           cv::Mat &swt_stroke_width_image) {
     //init SWT image
     swt_stroke_width_image.setTo(cv::Scalar(FLT_MAX));
 
-    int8_t direction = 1;
-    int step_size = 0;
-    int current_row = 0;
-    int current_col = 0;
-    std::vector<cv::Point2i> temporary_ray_pixels;
-
     if (black_on_white == true) {
-        direction = -1;
+        swt_cast_stripes(edges, direction_x, direction_y, limits, &rays, nullptr);
     } else {
-        direction = 1;
+        swt_cast_stripes(edges, direction_x, direction_y, limits, nullptr, &rays);
     }
+    swt_assign_widths(rays, swt_stroke_width_image);
+}
 
-    //LOOP OVER THE IMAGE
-    for (int i = 0; i < edges.rows; i++) {
-        for (int j = 0; j < edges.cols; j++) {
-            //a edge pixel is found
-
-           if (edges.at<unsigned char>(i, j)==255){
-
-                auto ray_dir_x = direction_x.at<float>(i, j);
-                auto ray_dir_y = direction_y.at<float>(i, j);
-                //first clear the temp ray array
-                step_size = 0;
-                temporary_ray_pixels.clear();
-                //put in the first pixel
-                temporary_ray_pixels.push_back(cv::Point2i(j, i));
-
-
-                //RAY EMIT FOR EVERY EDGE PIXEL check if iin boundary
-                while (true){
-                    step_size++;
-                    current_col = j;
-                    current_row = i;
-                    auto old_row = current_row;
-                    auto old_col = current_col;
-                    current_row = std::floor(i + (ray_dir_y *step_size * direction));
-                    current_col = std::floor(j + (ray_dir_x *step_size * direction));
-                    //has not moved do nothing
-                    if  (((current_row == old_row) && (current_col == old_col))){
-                        continue;
-                    }
-                    //check if new current_row or col is outside boundary
-                    if((current_col < 0 ) || (current_row < 0) || (current_row == edges.rows) || (current_col == edges.cols)){
-                        break;
+//===============================================================================
+// swt_compute_stroke_width_dual()
+//-------------------------------------------------------------------------------
+// Same as swt_compute_stroke_width() for both polarities at once. Every edge
+// pixel casts the ray against and along its gradient in the same scan, so the
+// edge scan and the direction loads are shared. Each polarity gets the rays and
+// the SWT image it would get from swt_compute_stroke_width(). The budgets of
+// the limits count the rays and steps of both polarities together.
+//
+// parameters:
+//  - edges: [CV_8UC1] matrix filled with the Canny-edges
+//  - direction_x: [CV_32FC1] matrix of the gradient direction in x direction
+//  - direction_y: [CV_32FC1] matrix of the gradient direction in y direction
+//  - limits: maximum ray length and per image budgets of rays and marched pixels
+//  - black_on_white_rays: list of the accepted black on white rays
+//  - black_on_white_image: [CV_32FC1] output matrix for the black on white stroke widths
+//  - white_on_black_rays: list of the accepted white on black rays
+//  - white_on_black_image: [CV_32FC1] output matrix for the white on black stroke widths
+// return: void
+//===============================================================================
+void algorithms::swt_compute_stroke_width_dual(const cv::Mat &edges, const cv::Mat &direction_x,
+                                               const cv::Mat &direction_y, const SwtLimits &limits,
+                                               RayList &black_on_white_rays, cv::Mat &black_on_white_image,
+                                               RayList &white_on_black_rays, cv::Mat &white_on_black_image)
+{
+    black_on_white_image.setTo(cv::Scalar(FLT_MAX));
+    white_on_black_image.setTo(cv::Scalar(FLT_MAX));
+
+    swt_cast_stripes(edges, direction_x, direction_y, limits, &black_on_white_rays, &white_on_black_rays);
+    swt_assign_widths(black_on_white_rays, black_on_white_image);
+    swt_assign_widths(white_on_black_rays, white_on_black_image);
+}
+
+//===============================================================================
+// swt_postprocessing()
+//-------------------------------------------------------------------------------
+// TODO: Compute the median for each ray and choose the appropriate stroke width.
+//       - Loop over the rays
+//       - Compute the median stroke width of each ray
+//       - Choose the minimum of the median and the pixels on the ray from first run
+// hint: use the the mathematical functions provided by the standard library
+//
+// Runs in two parallel passes. Chunks of rays re-march their pixels, fetch each
+// width once and keep min(width, median) in a buffer per chunk. Then row
+// stripes go through the rays crossing them in ray order, re-march their
+// positions and write the buffered widths, so where rays overlap the last ray
+// wins like in a serial run.
+//
+// parameters:
+//  - swt_stroke_width_image: [CV_32FC1] matrix with stroke widths from first run
+//  - rays: list of the rays, their pixels are re-marched with swt_ray_pixels()
+//  - swt_final_image: [CV_32FC1] output matrix with the postprocessed stroke widths, initialized with FLT_MAX
+// return: void
+//===============================================================================
+void algorithms::swt_postprocessing(const cv::Mat &swt_stroke_width_image, const RayList &rays,
+                                    cv::Mat &swt_final_image)
+{
+
+    //init SWT image
+    swt_final_image.setTo(cv::Scalar(0));
+
+    //clamped widths of every chunk of rays, ray_widths points to the ones of each ray
+    const int num_chunks = swt_num_stripes(rays.size());
+    std::vector<std::vector<float>> chunk_widths(num_chunks);
+    std::vector<const float *> ray_widths(rays.size());
+    cv::parallel_for_(cv::Range(0, num_chunks), [&](const cv::Range &range) {
+        std::vector<cv::Point2i> temporary_ray_pos;
+        std::vector<float> temporary_ray_width;
+        for (int chunk = range.start; chunk < range.end; chunk++) {
+            size_t first = rays.size() * chunk / num_chunks;
+            size_t last = rays.size() * (chunk + 1) / num_chunks;
+            std::vector<float> &widths = chunk_widths[chunk];
+            widths.reserve(std::accumulate(rays.begin() + first, rays.begin() + last, (size_t)0,
+                                           [](const size_t sum, const Ray &ray) { return sum + ray.length; }));
+            for (size_t i = first; i < last; i++) {
+                swt_ray_pixels(rays[i], temporary_ray_pos);
+                const size_t offset = widths.size();
+                for (size_t k = 0; k < temporary_ray_pos.size(); k++) {
+                    widths.push_back(swt_stroke_width_image.at<float>(temporary_ray_pos[k]));
+                }
+
+                temporary_ray_width.assign(widths.begin() + offset, widths.end());
+                float median = helper::median(temporary_ray_width.data(), temporary_ray_width.size());
+
+                //clamp all to median
+                for (size_t k = offset; k < widths.size(); k++) {
+                    widths[k] = std::min(widths[k], median);
+                }
+            }
+            for (size_t i = first, offset = 0; i < last; i++) {
+                ray_widths[i] = widths.data() + offset;
+                offset += rays[i].length;
+            }
+        }
+    });
+
+    //every stripe writes its own rows, going through the rays crossing it in order
+    const int rows = swt_final_image.rows;
+    const int num_stripes = swt_num_stripes(rows);
+    std::vector<int> stripe_first;
+    std::vector<int> stripe_rays;
+    swt_stripe_rays(rays, rows, num_stripes, stripe_first, stripe_rays);
+    cv::parallel_for_(cv::Range(0, num_stripes), [&](const cv::Range &range) {
+        std::vector<cv::Point2i> temporary_ray_pos;
+        for (int stripe = range.start; stripe < range.end; stripe++) {
+            int row_begin = (int)((long long)rows * stripe / num_stripes);
+            int row_end = (int)((long long)rows * (stripe + 1) / num_stripes);
+            for (int r = stripe_first[stripe]; r < stripe_first[stripe + 1]; r++) {
+                const int i = stripe_rays[r];
+                swt_ray_pixels(rays[i], temporary_ray_pos);
+                for (size_t k = 0; k < temporary_ray_pos.size(); k++) {
+                    const cv::Point2i &point = temporary_ray_pos[k];
+                    if ((point.y >= row_begin) && (point.y < row_end)) {
+                        swt_final_image.at<float>(point) = ray_widths[i][k];
                     }
+                }
+            }
+        }
+    });
 
+}
 
-                    //another edge pixel found, check if valid
-                    if (edges.at<unsigned char>(current_row, current_col)==255) {
-                        //now check if indeed ray is valid
-                        auto curr_dir_x = direction_x.at<float>(current_row, current_col);
-                        auto curr_dir_y = direction_y.at<float>(current_row, current_col);
+//flood fill with the label type of the labels matrix, false if the labels run out
+template <typename Label>
+static bool flood_fill_components(const cv::Mat &swt_image, const float stroke_width_ratio_threshold,
+                                  const int neighbor_offset, cv::Mat &labels,
+                                  std::vector<std::vector<cv::Point2i>> &components)
+{
 
-                        double dotp = ((ray_dir_x * curr_dir_x) +(ray_dir_y * curr_dir_y)) *(double)(-1);
-                        //if yes copy over to ray array
-                        if (dotp >= cos(CV_PI / 6)) {
-                            if (temporary_ray_pixels.back() != cv::Point2i(current_col, current_row)) {
-                                temporary_ray_pixels.push_back(cv::Point2i(current_col, current_row));
-                            }
+    algorithms::PosStrokeWidth temp;
+    unsigned int curr_label = 1;
+    labels.setTo(cv::Scalar(0));
+    std::vector<algorithms::PosStrokeWidth> neighbors;
+    std::vector<cv::Point2i> temp_component;
 
-                            rays.push_back(std::vector<cv::Point2i>(temporary_ray_pixels));
-                            //calculate stroke width of ray
+    //LOOP OVER THE IMAGE
+    for (int i = 0; i < swt_image.rows; i++) {
+        for (int j = 0; j < swt_image.cols; j++) {
+            //first skip all stroke width zeros and already labeled pixels
+            if ((swt_image.at<float>(i,j) != 0) && (labels.at<Label>(i,j) == 0)){
+                if (curr_label > (unsigned int)std::numeric_limits<Label>::max()) {
+                    return false;
+                }
 
-                            auto sumx = temporary_ray_pixels.front().x - temporary_ray_pixels.back().x;
-                            auto sumy = temporary_ray_pixels.front().y - temporary_ray_pixels.back().y;
-                            auto wid = sqrt(pow(sumx,2)+pow(sumy,2));
-                            //assign stroke width to every pixel of the ray
-                            for (auto point :  temporary_ray_pixels) {
+                //now add the first pixel to a component, then a recursion finds all connected pixels, then a new component gets a new label_cnt
+                temp.col = j;
+                temp.row = i;
+                temp.stroke_width = swt_image.at<float>(i,j);
+                neighbors.clear();
+                neighbors.push_back(temp);
+                // the first element can only be valid.
 
-                                 if  (wid < swt_stroke_width_image.at<float>(point)){
-                                    swt_stroke_width_image.at<float>(point) = wid;
-                                 }
-                            }
+                //iterate over neighbors
+                while (neighbors.size() > 0){
+                    //take out one element from the neighborhood list and perform all checks
 
-                        }
+                    auto neighbor_to_check = neighbors.back();
+                    neighbors.pop_back();
+                   //now find neighbors of candidate and also put them on the neigbor list
+                            for (int k = (neighbor_to_check.row - neighbor_offset); k < (neighbor_to_check.row + neighbor_offset +1); ++k) {
+                                for (int l = (neighbor_to_check.col - neighbor_offset); l < (neighbor_to_check.col + neighbor_offset +1); ++l) {
+                                    //add all neighbours to queue
+                                    if ((k >= 0) && (l>= 0) && (k< swt_image.rows) && (l< swt_image.cols)) {
+                                        if ((labels.at<Label>(k, l) == 0) && (swt_image.at<float>(k, l) != 0)) {
+
+                                            temp.col = l;
+                                            temp.row = k;
+                                            temp.stroke_width = swt_image.at<float>(k, l);
+
+                                            double stroke_ratio = neighbor_to_check.stroke_width / temp.stroke_width;
+                                            if ((stroke_ratio > (1/stroke_width_ratio_threshold)) && (stroke_ratio < stroke_width_ratio_threshold)) {
+                                                labels.at<Label>(temp.row,temp.col) = curr_label;
+                                                temp_component.push_back(cv::Point2i(temp.col, temp.row));
+                                                neighbors.push_back(temp);
+                                            }
+                                        }
+                                    }
+                                }
 
-                       //in any way discard temp ray after
-                        temporary_ray_pixels.clear();
-                        break;
                     }
 
 
-                    //still marching
-                    else {
-                        //store ray pixels on the way
-                        if (temporary_ray_pixels.back() != cv::Point2i(current_col, current_row)) {
-                            temporary_ray_pixels.push_back(cv::Point2i(current_col, current_row));
+               }
+
+
+               //all done: add component to components and find next component
+               components.push_back(temp_component);
+               temp_component.clear();
+
+               curr_label ++;
+
+
+            }
+
+        }
+    }
+    return true;
+}
+
+//===============================================================================
+// get_connected_components_flood_fill()
+//-------------------------------------------------------------------------------
+// Reference version of get_connected_components: a depth first flood fill from
+// every unlabeled pixel in raster order. get_connected_components falls back to
+// it for inputs the two-pass labelling cannot reproduce.
+//
+// parameters:
+//  - see get_connected_components()
+// return: void
+//===============================================================================
+void algorithms::get_connected_components_flood_fill(const cv::Mat &swt_image, const float stroke_width_ratio_threshold,
+                                                     const int neighbor_offset, cv::Mat &labels,
+                                                     std::vector<std::vector<cv::Point2i>> &components)
+{
+    size_t first_component = components.size();
+    if ((labels.type() != CV_32SC1) && flood_fill_components<unsigned short>(swt_image, stroke_width_ratio_threshold,
+                                                                            neighbor_offset, labels, components)) {
+        return;
+    }
+
+    //more components than 16 bit labels can hold
+    components.resize(first_component);
+    labels.create(swt_image.size(), CV_32SC1);
+    flood_fill_components<int>(swt_image, stroke_width_ratio_threshold, neighbor_offset, labels, components);
+}
+
+//stroke width ratio predicate between a labeled pixel and its neighbor
+static bool similar_stroke_width(const float from, const float to, const float threshold,
+                                 const float inverse_threshold)
+{
+    double stroke_ratio = from / to;
+    return (stroke_ratio > inverse_threshold) && (stroke_ratio < threshold);
+}
+
+//root of a label inside one strip, halving the path on the way
+static int find_label_root(std::vector<int> &parent, int label)
+{
+    while (parent[label] != label) {
+        parent[label] = parent[parent[label]];
+        label = parent[label];
+    }
+    return label;
+}
+
+//root of a label, halving the path on the way. Parents are always smaller
+//labels and only roots are relinked, so this is safe while other strips unite
+static int find_label_root(std::atomic<int> *parent, int label)
+{
+    int next = parent[label].load(std::memory_order_relaxed);
+    while (next != label) {
+        int grandparent = parent[next].load(std::memory_order_relaxed);
+        parent[label].store(grandparent, std::memory_order_relaxed);
+        label = grandparent;
+        next = parent[label].load(std::memory_order_relaxed);
+    }
+    return label;
+}
+
+//unites the trees of two labels, the smaller root stays the root. The root is
+//only relinked if no other strip relinked it in the meantime
+static void unite_labels(std::atomic<int> *parent, int first, int second)
+{
+    while (true) {
+        first = find_label_root(parent, first);
+        second = find_label_root(parent, second);
+        if (first == second) {
+            return;
+        }
+        if (first > second) {
+            std::swap(first, second);
+        }
+        int expected = second;
+        if (parent[second].compare_exchange_weak(expected, first)) {
+            return;
+        }
+    }
+}
+
+//steps the flood fill can take between two neighbors
+enum StrokeWidthSteps
+{
+    NO_STEP = 0,
+    FORWARD_STEP = 1,
+    BACKWARD_STEP = 2,
+    BOTH_STEPS = FORWARD_STEP | BACKWARD_STEP
+};
+
+//ratio check of two neighbors in both directions, asks for the flood fill on
+//widths it cannot handle
+struct SimilarStrokeWidth
+{
+    float threshold;
+    float inverse_threshold;
+    std::atomic<bool> *use_flood_fill;
+
+    int operator()(const float from, const float to) const
+    {
+        return (similar_stroke_width(from, to, threshold, inverse_threshold) ? FORWARD_STEP : NO_STEP) |
+               (similar_stroke_width(to, from, threshold, inverse_threshold) ? BACKWARD_STEP : NO_STEP);
+    }
+};
+
+//records the step between two labels that the ratio check only allows one way
+static void add_one_way_step(const int steps, const int from, const int to,
+                             std::vector<std::pair<int, int>> &one_way_steps)
+{
+    if (steps == FORWARD_STEP) {
+        one_way_steps.push_back(std::make_pair(from, to));
+    } else if (steps == BACKWARD_STEP) {
+        one_way_steps.push_back(std::make_pair(to, from));
+    }
+}
+
+//===============================================================================
+// label_strip()
+//-------------------------------------------------------------------------------
+// First pass of get_connected_components() for the rows of one strip: unites
+// every stroke pixel with the earlier pixels of its neighborhood inside the
+// strip. Offset > 0 fixes the neighbor offset at compile time, so away from
+// the borders the neighborhood is walked with constant bounds and the loops are
+// unrolled. Offset < 0 takes neighbor_offset at run time. Neighbors the ratio
+// check only allows one way are not united but recorded in one_way_steps.
+//
+// parameters:
+//  - swt_image: [CV_32FC1] matrix with the stroke widths
+//  - neighbor_offset: maximum offset for the neighborhood pixels, only used if Offset < 0
+//  - row_begin, row_end: rows of the strip, row_end excluded
+//  - similar: ratio check of two neighbors
+//  - window: labels of the last neighbor_offset + 1 rows, (neighbor_offset + 1) * cols entries
+//  - parent: union-find forest of the strip, labels counted from 0
+//  - columns: output with the column of every label
+//  - row_first: output with the first label of every row
+//  - one_way_steps: output with the one-way steps between labels as (from, to)
+// return: void
+//===============================================================================
+template <int Offset>
+static void label_strip(const cv::Mat &swt_image, const int neighbor_offset, const int row_begin, const int row_end,
+                        const SimilarStrokeWidth &similar, std::vector<int> &window, std::vector<int> &parent,
+                        std::vector<int> &columns, std::vector<int> &row_first,
+                        std::vector<std::pair<int, int>> &one_way_steps)
+{
+    const int offset = (Offset > 0) ? Offset : neighbor_offset;
+    const int cols = swt_image.cols;
+    //rows of the neighborhood from i - offset to i, nullptr above the strip
+    std::vector<const float *> neighbor_swt_rows(offset + 1);
+    std::vector<const int *> neighbor_window_rows(offset + 1);
+
+    for (int i = row_begin; (i < row_end) && !*similar.use_flood_fill; i++) {
+        const float *swt_row = swt_image.ptr<float>(i);
+        int *window_row = &window[(size_t)(i % (offset + 1)) * cols];
+        row_first[i] = (int)parent.size();
+        for (int d = 0; d <= offset; d++) {
+            const int k = i - offset + d;
+            neighbor_swt_rows[d] = (k >= row_begin) ? swt_image.ptr<float>(k) : nullptr;
+            neighbor_window_rows[d] = &window[(size_t)((k + offset + 1) % (offset + 1)) * cols];
+        }
+        const float *const *swt_rows = neighbor_swt_rows.data();
+        const int *const *window_rows = neighbor_window_rows.data();
+        const bool full_height = (i - offset >= row_begin);
+
+        for (int j = 0; j < cols; j++) {
+            const float stroke_width = swt_row[j];
+            if (stroke_width == 0) {
+                continue;
+            }
+            if (!std::isfinite(stroke_width)) {
+                *similar.use_flood_fill = true;
+                break;
+            }
+
+            const int label = (int)parent.size();
+            int root = -1;
+            auto unite = [&](const int d, const int l) {
+                const float neighbor_width = swt_rows[d][l];
+                if (neighbor_width == 0) {
+                    return;
+                }
+                int neighbor_root = find_label_root(parent, window_rows[d][l]);
+                if (neighbor_root == root) {
+                    return;
+                }
+                const int steps = similar(neighbor_width, stroke_width);
+                if (steps != BOTH_STEPS) {
+                    add_one_way_step(steps, window_rows[d][l], label, one_way_steps);
+                    return;
+                }
+
+                if (root < 0) {
+                    root = neighbor_root;
+                } else {
+                    //the smaller label stays the root
+                    parent[std::max(root, neighbor_root)] = std::min(root, neighbor_root);
+                    root = std::min(root, neighbor_root);
+                }
+            };
+
+            //the left neighbor has the same width, so it is united with this pixel and
+            //already got the same answers from the neighborhood, except from the
+            //column that enters on the right
+            const bool same_as_left = (offset > 0) && (j > 0) && (swt_row[j - 1] == stroke_width);
+            if (same_as_left) {
+                root = find_label_root(parent, window_row[j - 1]);
+            }
+
+            //earlier pixels of the neighborhood: the rows above and the left part of this row
+            if ((Offset > 0) && full_height && (j >= Offset) && (j + Offset < cols)) {
+                if (same_as_left) {
+                    for (int d = 0; d < Offset; d++) {
+                        unite(d, j + Offset);
+                    }
+                } else {
+                    for (int d = 0; d < Offset; d++) {
+                        for (int l = j - Offset; l <= j + Offset; l++) {
+                            unite(d, l);
                         }
-                        continue;
                     }
-
+                    for (int l = j - Offset; l < j; l++) {
+                        unite(Offset, l);
+                    }
+                }
+            } else {
+                const int l_begin = same_as_left ? j + offset : std::max(0, j - offset);
+                for (int d = std::max(0, row_begin - (i - offset)); d <= offset; d++) {
+                    const int l_end = (d < offset) ? std::min(cols - 1, j + offset) : j - 1;
+                    for (int l = l_begin; l <= l_end; l++) {
+                        unite(d, l);
+                    }
                 }
-
-
             }
 
-
+            window_row[j] = label;
+            parent.push_back((root < 0) ? label : root);
+            columns.push_back(j);
         }
     }
-
 }
 
+//features of a component inside one run strip, merged in strip order afterwards
+struct StripComponentSums
+{
+    cv::Point2i min_point;
+    cv::Point2i max_point;
+    int pixel_count;
+    double width_sum;
+    cv::Vec3d color_sum;
+};
+
 //===============================================================================
-// swt_postprocessing()
+// label_components()
 //-------------------------------------------------------------------------------
-// TODO: Compute the median for each ray and choose the appropriate stroke width.
-//       - Loop over the rays
-//       - Compute the median stroke width of each ray
-//       - Choose the minimum of the median and the pixels on the ray from first run
-// hint: use the the mathematical functions provided by the standard library
+// The labelling of get_connected_components(), see there. If stats is given,
+// the pass that writes the labels also collects the bounding box, the pixel
+// count, the width sum and the color sum of every component, per run strip,
+// and the strips are merged in order.
 //
 // parameters:
-//  - swt_stroke_width_image: [CV_32FC1] matrix with stroke widths from first run
-//  - rays: vector of vectors of points (x = col, y = row)
-//  - swt_final_image: [CV_32FC1] output matrix with the postprocessed stroke widths, initialized with FLT_MAX
+//  - input_image: [CV_8UC3] matrix with the input image for the color sums, the sums stay 0 otherwise
+//  - stats: optional output with the features of every component, without the width histograms
+//  - see get_connected_components() for the others
 // return: void
 //===============================================================================
-void algorithms::swt_postprocessing(const cv::Mat &swt_stroke_width_image,
-                                    const std::vector<std::vector<cv::Point2i>> &rays, cv::Mat &swt_final_image)
+static void label_components(const cv::Mat &swt_image, const cv::Mat &input_image,
+                             const float stroke_width_ratio_threshold, const int neighbor_offset, cv::Mat &labels,
+                             algorithms::RunComponents &components, std::vector<algorithms::ComponentStats> *stats)
 {
+    const float inverse_threshold = 1 / stroke_width_ratio_threshold;
+    const int rows = swt_image.rows;
+    const int cols = swt_image.cols;
+    components = algorithms::RunComponents();
+
+    auto flood_fill = [&]() {
+        std::vector<std::vector<cv::Point2i>> point_components;
+        algorithms::get_connected_components_flood_fill(swt_image, stroke_width_ratio_threshold, neighbor_offset,
+                                                        labels, point_components);
+        algorithms::encode_runs(point_components, components);
+        if (stats != nullptr) {
+            algorithms::compute_component_stats(swt_image, input_image, components, *stats, false);
+        }
+    };
 
-    //init SWT image
-    swt_final_image.setTo(cv::Scalar(0));
-
-    std::vector<float> temporary_ray_width;
-    std::vector<cv::Point2i> temporary_ray_pos;
+    //a seed pixel is labeled as its own neighbor
+    if ((neighbor_offset < 0) || ((long long)rows * cols > INT_MAX) ||
+        !similar_stroke_width(1.0f, 1.0f, stroke_width_ratio_threshold, inverse_threshold)) {
+        flood_fill();
+        return;
+    }
 
-    float median;
-    //for each ray
-    for (auto ray : rays) {
+    //one strip per thread, each a few neighborhoods high
+    const int num_strips = std::max(1, std::min(cv::getNumThreads(), rows / (4 * (neighbor_offset + 1))));
+    auto strip_row = [rows, num_strips](const int strip) { return (int)((long long)rows * strip / num_strips); };
+    std::atomic<bool> use_flood_fill(false);
+
+    const SimilarStrokeWidth similar = {stroke_width_ratio_threshold, inverse_threshold, &use_flood_fill};
+
+    //the kernel is picked once per image
+    auto label_strip_rows = &label_strip<-1>;
+    if (neighbor_offset == 1) {
+        label_strip_rows = &label_strip<1>;
+    } else if (neighbor_offset == 2) {
+        label_strip_rows = &label_strip<2>;
+    } else if (neighbor_offset == 3) {
+        label_strip_rows = &label_strip<3>;
+    }
 
-        //copy over width value of each ray and pixel positions of each ray
-        for (auto point : ray) {
-            temporary_ray_width.push_back(swt_stroke_width_image.at<float>(point));
-            temporary_ray_pos.push_back(point);
+    //first pass: union-find inside the strips, with labels counted from 0 in
+    //every strip. row_first holds the first label of every row
+    std::vector<std::vector<int>> strip_parents(num_strips);
+    std::vector<std::vector<int>> strip_columns(num_strips);
+    std::vector<std::vector<std::pair<int, int>>> strip_one_way_steps(num_strips);
+    std::vector<int> row_first(rows + 1, 0);
+    cv::parallel_for_(cv::Range(0, num_strips), [&](const cv::Range &range) {
+        //labels of the last neighbor_offset + 1 rows, only read at stroke pixels
+        std::vector<int> window((size_t)(neighbor_offset + 1) * cols);
+
+        for (int strip = range.start; strip < range.end; strip++) {
+            label_strip_rows(swt_image, neighbor_offset, strip_row(strip), strip_row(strip + 1), similar, window,
+                             strip_parents[strip], strip_columns[strip], row_first, strip_one_way_steps[strip]);
         }
+    });
+    if (use_flood_fill) {
+        flood_fill();
+        return;
+    }
 
-        auto size_of_ray = temporary_ray_width.size();
-        int size_half = floor(size_of_ray /2 );
-        if  (size_of_ray > 0) {
-            //sort each ray
-            std::sort(temporary_ray_width.begin(),temporary_ray_width.end());
-
-            if (size_of_ray % 2 == 0){ // even
-               median = (temporary_ray_width[size_half]+temporary_ray_width[size_half-1])/2;
-
-            }else{ //odd
-                median = temporary_ray_width[size_half];
+    //labels of all strips in one raster order
+    std::vector<int> strip_first(num_strips + 1, 0);
+    for (int strip = 0; strip < num_strips; strip++) {
+        strip_first[strip + 1] = strip_first[strip] + (int)strip_parents[strip].size();
+    }
+    const int num_pixels = strip_first[num_strips];
+    std::unique_ptr<std::atomic<int>[]> parent(new std::atomic<int>[std::max(1, num_pixels)]);
+    std::vector<int> columns(num_pixels);
+    cv::parallel_for_(cv::Range(0, num_strips), [&](const cv::Range &range) {
+        for (int strip = range.start; strip < range.end; strip++) {
+            const int first = strip_first[strip];
+            for (size_t label = 0; label < strip_parents[strip].size(); label++) {
+                parent[first + label].store(first + strip_parents[strip][label], std::memory_order_relaxed);
+                columns[first + label] = strip_columns[strip][label];
             }
-
+            for (int i = strip_row(strip); i < strip_row(strip + 1); i++) {
+                row_first[i] += first;
+            }
+            for (size_t k = 0; k < strip_one_way_steps[strip].size(); k++) {
+                strip_one_way_steps[strip][k].first += first;
+                strip_one_way_steps[strip][k].second += first;
+            }
+            std::vector<int>().swap(strip_parents[strip]);
+            std::vector<int>().swap(strip_columns[strip]);
         }
-
-        //set final image   //clamp all to mean
-        for (auto point : temporary_ray_pos) {
-            auto width = swt_stroke_width_image.at<float>(point);
-            if  (width > median){
-                swt_final_image.at<float>(point) = median;
-            }else{
-                swt_final_image.at<float>(point) = swt_stroke_width_image.at<float>(point);
+    });
+    row_first[rows] = num_pixels;
+
+    //unite the first rows of every strip with their neighbors above it
+    cv::parallel_for_(cv::Range(1, num_strips), [&](const cv::Range &range) {
+        for (int strip = range.start; strip < range.end; strip++) {
+            const int border = strip_row(strip);
+            const int border_end = std::min(strip_row(strip + 1), border + neighbor_offset);
+            const int top = std::max(0, border - neighbor_offset);
+
+            //labels of the rows above the border, -1 for no stroke
+            std::vector<int> window((size_t)(border - top) * cols, -1);
+            for (int k = top; k < border; k++) {
+                for (int label = row_first[k]; label < row_first[k + 1]; label++) {
+                    window[(size_t)(k - top) * cols + columns[label]] = label;
+                }
             }
 
+            for (int i = border; i < border_end; i++) {
+                const float *swt_row = swt_image.ptr<float>(i);
+                for (int label = row_first[i]; label < row_first[i + 1]; label++) {
+                    const int j = columns[label];
+                    for (int k = std::max(top, i - neighbor_offset); k < border; k++) {
+                        const float *neighbor_swt_row = swt_image.ptr<float>(k);
+                        const int *neighbor_window_row = &window[(size_t)(k - top) * cols];
+                        for (int l = std::max(0, j - neighbor_offset); l <= std::min(cols - 1, j + neighbor_offset);
+                             l++) {
+                            const int neighbor = neighbor_window_row[l];
+                            if ((neighbor < 0) ||
+                                (find_label_root(parent.get(), neighbor) == find_label_root(parent.get(), label))) {
+                                continue;
+                            }
+                            const int steps = similar(neighbor_swt_row[l], swt_row[j]);
+                            if (steps == BOTH_STEPS) {
+                                unite_labels(parent.get(), label, neighbor);
+                            } else {
+                                add_one_way_step(steps, neighbor, label, strip_one_way_steps[strip]);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    //one-way steps between the roots, sorted by the root they start from
+    std::vector<std::pair<int, int>> root_steps;
+    for (int strip = 0; strip < num_strips; strip++) {
+        for (size_t k = 0; k < strip_one_way_steps[strip].size(); k++) {
+            int from = find_label_root(parent.get(), strip_one_way_steps[strip][k].first);
+            int to = find_label_root(parent.get(), strip_one_way_steps[strip][k].second);
+            if (from != to) {
+                root_steps.push_back(std::make_pair(from, to));
+            }
+        }
+        std::vector<std::pair<int, int>>().swap(strip_one_way_steps[strip]);
+    }
+    if (!root_steps.empty()) {
+        std::sort(root_steps.begin(), root_steps.end());
+        root_steps.erase(std::unique(root_steps.begin(), root_steps.end()), root_steps.end());
+
+        //the roots are the first pixels of their components, so going through them
+        //in ascending order is the order of the flood fill seeds. Every root that is
+        //not taken yet takes all roots it reaches and stays their root
+        std::vector<int> seeds;
+        for (size_t k = 0; k < root_steps.size(); k++) {
+            seeds.push_back(root_steps[k].first);
+            seeds.push_back(root_steps[k].second);
         }
-        temporary_ray_width.clear();
-        temporary_ray_pos.clear();
+        std::sort(seeds.begin(), seeds.end());
+        seeds.erase(std::unique(seeds.begin(), seeds.end()), seeds.end());
+
+        std::vector<bool> taken(num_pixels, false);
+        std::vector<int> reached;
+        for (size_t s = 0; s < seeds.size(); s++) {
+            const int seed = seeds[s];
+            if (taken[seed]) {
+                continue;
+            }
+            taken[seed] = true;
+            reached.assign(1, seed);
+            while (!reached.empty()) {
+                const int from = reached.back();
+                reached.pop_back();
+                auto step = std::lower_bound(root_steps.begin(), root_steps.end(), std::make_pair(from, INT_MIN));
+                for (; (step != root_steps.end()) && (step->first == from); ++step) {
+                    if (!taken[step->second]) {
+                        taken[step->second] = true;
+                        parent[step->second].store(seed, std::memory_order_relaxed);
+                        reached.push_back(step->second);
+                    }
+                }
+            }
+        }
+    }
 
+    //number the roots in raster order, strip by strip
+    std::vector<int> component_first(num_strips + 1, 0);
+    cv::parallel_for_(cv::Range(0, num_strips), [&](const cv::Range &range) {
+        for (int strip = range.start; strip < range.end; strip++) {
+            int num_roots = 0;
+            for (int label = row_first[strip_row(strip)]; label < row_first[strip_row(strip + 1)]; label++) {
+                num_roots += (parent[label].load(std::memory_order_relaxed) == label);
+            }
+            component_first[strip + 1] = num_roots;
+        }
+    });
+    for (int strip = 0; strip < num_strips; strip++) {
+        component_first[strip + 1] += component_first[strip];
+    }
+    const int num_components = component_first[num_strips];
+    if ((labels.type() != CV_32SC1) && (num_components > USHRT_MAX)) {
+        //more components than 16 bit labels can hold
+        labels.create(swt_image.size(), CV_32SC1);
+    }
+    const bool wide_labels = (labels.type() == CV_32SC1);
+
+    std::vector<int> component(num_pixels);
+    cv::parallel_for_(cv::Range(0, num_strips), [&](const cv::Range &range) {
+        for (int strip = range.start; strip < range.end; strip++) {
+            int next_component = component_first[strip];
+            for (int label = row_first[strip_row(strip)]; label < row_first[strip_row(strip + 1)]; label++) {
+                if (parent[label].load(std::memory_order_relaxed) == label) {
+                    component[label] = ++next_component;
+                }
+            }
+        }
+    });
+
+    //second pass: every pixel takes the component of its root, and the runs are
+    //counted per strip and component, at most one counter per pixel
+    const int run_strips = (int)std::max(1LL, std::min((long long)num_strips,
+                                                       (long long)rows * cols / std::max(1, num_components)));
+    auto run_strip_row = [rows, run_strips](const int strip) {
+        return (int)((long long)rows * strip / run_strips);
+    };
+    //a run starts where the columns jump or the component changes
+    auto starts_run = [&](const int row, const int label) {
+        return (label == row_first[row]) || (columns[label] != columns[label - 1] + 1) ||
+               (component[label] != component[label - 1]);
+    };
+    std::vector<int> run_offsets((size_t)run_strips * num_components, 0);
+    //features of the components touched by every strip, with the slot of each
+    //component per strip, -1 if the strip does not touch it
+    const bool has_colors = (input_image.type() == CV_8UC3) && (input_image.size() == swt_image.size());
+    std::vector<std::vector<StripComponentSums>> strip_sums((stats != nullptr) ? run_strips : 0);
+    std::vector<int> sum_slots((stats != nullptr) ? (size_t)run_strips * num_components : 0, -1);
+    labels.setTo(cv::Scalar(0));
+    cv::parallel_for_(cv::Range(0, run_strips), [&](const cv::Range &range) {
+        for (int strip = range.start; strip < range.end; strip++) {
+            int *counts = run_offsets.data() + (size_t)strip * num_components;
+            for (int i = run_strip_row(strip); i < run_strip_row(strip + 1); i++) {
+                const float *swt_row = swt_image.ptr<float>(i);
+                for (int label = row_first[i]; label < row_first[i + 1]; label++) {
+                    int root = find_label_root(parent.get(), label);
+                    if (root != label) {
+                        component[label] = component[root];
+                    }
+                    if (wide_labels) {
+                        labels.ptr<int>(i)[columns[label]] = component[label];
+                    } else {
+                        labels.ptr<unsigned short>(i)[columns[label]] = (unsigned short)component[label];
+                    }
+                    if (starts_run(i, label)) {
+                        counts[component[label] - 1]++;
+                    }
+                    if (stats == nullptr) {
+                        continue;
+                    }
 
+                    int &slot = sum_slots[(size_t)strip * num_components + component[label] - 1];
+                    if (slot < 0) {
+                        slot = (int)strip_sums[strip].size();
+                        StripComponentSums empty = {cv::Point2i(INT_MAX, INT_MAX), cv::Point2i(INT_MIN, INT_MIN), 0,
+                                                    0, cv::Vec3d()};
+                        strip_sums[strip].push_back(empty);
+                    }
+                    StripComponentSums &sums = strip_sums[strip][slot];
+                    const int j = columns[label];
+                    sums.min_point.x = std::min(sums.min_point.x, j);
+                    sums.min_point.y = std::min(sums.min_point.y, i);
+                    sums.max_point.x = std::max(sums.max_point.x, j);
+                    sums.max_point.y = std::max(sums.max_point.y, i);
+                    sums.pixel_count++;
+                    sums.width_sum += swt_row[j];
+                    if (has_colors) {
+                        const cv::Vec3b &color = input_image.ptr<cv::Vec3b>(i)[j];
+                        for (int channel = 0; channel < 3; channel++) {
+                            sums.color_sum[channel] += color[channel];
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    //features of every component, its strips merged in order
+    if (stats != nullptr) {
+        stats->assign(num_components, algorithms::ComponentStats());
+        cv::parallel_for_(cv::Range(0, num_components), [&](const cv::Range &range) {
+            for (int c = range.start; c < range.end; c++) {
+                algorithms::ComponentStats &component_stats = (*stats)[c];
+                cv::Point2i min_point(INT_MAX, INT_MAX);
+                cv::Point2i max_point(INT_MIN, INT_MIN);
+                for (int strip = 0; strip < run_strips; strip++) {
+                    const int slot = sum_slots[(size_t)strip * num_components + c];
+                    if (slot < 0) {
+                        continue;
+                    }
+                    const StripComponentSums &sums = strip_sums[strip][slot];
+                    min_point.x = std::min(min_point.x, sums.min_point.x);
+                    min_point.y = std::min(min_point.y, sums.min_point.y);
+                    max_point.x = std::max(max_point.x, sums.max_point.x);
+                    max_point.y = std::max(max_point.y, sums.max_point.y);
+                    component_stats.pixel_count += sums.pixel_count;
+                    component_stats.width_sum += sums.width_sum;
+                    component_stats.color_sum += sums.color_sum;
+                }
+                component_stats.bounding_box = cv::Rect2i(min_point.x, min_point.y, max_point.x - min_point.x + 1,
+                                                          max_point.y - min_point.y + 1);
+            }
+        }, swt_num_stripes(num_components));
     }
 
+    //runs grouped by component, every component's runs in strip order
+    components.first_run.resize(num_components + 1);
+    int num_runs = 0;
+    for (int c = 0; c < num_components; c++) {
+        components.first_run[c] = num_runs;
+        for (int strip = 0; strip < run_strips; strip++) {
+            int &offset = run_offsets[(size_t)strip * num_components + c];
+            int count = offset;
+            offset = num_runs;
+            num_runs += count;
+        }
+    }
+    components.first_run[num_components] = num_runs;
+    components.runs.resize(num_runs);
+
+    cv::parallel_for_(cv::Range(0, run_strips), [&](const cv::Range &range) {
+        for (int strip = range.start; strip < range.end; strip++) {
+            int *offsets = run_offsets.data() + (size_t)strip * num_components;
+            for (int i = run_strip_row(strip); i < run_strip_row(strip + 1); i++) {
+                for (int label = row_first[i]; label < row_first[i + 1];) {
+                    int run_end = label + 1;
+                    while ((run_end < row_first[i + 1]) && !starts_run(i, run_end)) {
+                        run_end++;
+                    }
+                    algorithms::Run run = {i, columns[label], columns[run_end - 1] + 1, component[label]};
+                    components.runs[offsets[component[label] - 1]++] = run;
+                    label = run_end;
+                }
+            }
+        }
+    });
 }
 
 //===============================================================================
@@ -302,84 +1631,284 @@ void algorithms::swt_postprocessing(const cv::Mat &swt_stroke_width_image,
 //        - you can use the provided struct PosStrokeWidth{col, row, stroke_width}
 //          to store the necessary values of a neighbor
 //
+// Union-find labelling in row strips, one per thread. Every stroke pixel gets a
+// provisional label, its index in raster order among the stroke pixels, and the
+// smaller label stays the root, so the root of a component is its first pixel
+// in raster order. Each strip unites its pixels with the earlier pixels of their
+// neighborhood inside the strip. A pixel with the same width as its left
+// neighbor only checks the column entering the window on the right, so inside
+// strokes the cost grows with the offset instead of its square. Offsets 1 to 3
+// have their own label_strip() with unrolled loops. Then the first rows of
+// every strip are united with their neighbors above the strip, in parallel
+// with a compare-and-swap on the roots. The roots are numbered in raster
+// order, which is the order in which the flood fill finds its seeds, and the
+// runs are collected row by row. Neighbors the ratio check only allows one way
+// are kept as steps between the components: like the flood fill, every
+// component in raster order takes all components it can step into that are not
+// taken yet. Non-finite widths are left to get_connected_components_flood_fill().
+// A CV_16UC1 labels matrix is replaced by a CV_32SC1 one if there are more
+// than 65535 components.
+//
 // parameters:
 //  - swt_image: [CV_32FC1] matrix with the stroke widths
 //  - stroke_width_ratio_threshold: ratio of the stroke widths between two neighboring pixels
 //  - neighbor_offset: maximum offset for the neighborhood pixels
-//  - labels: [CV_16UC1] output matrix with component labels for each position
-//  - components: vector of vectors of points (x = col, y = row)
+//  - labels: [CV_16UC1 or CV_32SC1] output matrix with component labels for each position
+//  - components: output with the runs of the components
 // return: void
 //===============================================================================
 
+void algorithms::get_connected_components(const cv::Mat &swt_image, const float stroke_width_ratio_threshold,
+                                          const int neighbor_offset, cv::Mat &labels, RunComponents &components)
+{
+    label_components(swt_image, cv::Mat(), stroke_width_ratio_threshold, neighbor_offset, labels, components, nullptr);
+}
+
+//===============================================================================
+// get_connected_components()
+//-------------------------------------------------------------------------------
+// Point list version of the run-length encoded labelling above, the points of
+// every component are in raster order.
+//
+// parameters:
+//  - components: vector of vectors of points (x = col, y = row), appended to
+//  - see get_connected_components() above for the others
+// return: void
+//===============================================================================
 void algorithms::get_connected_components(const cv::Mat &swt_image, const float stroke_width_ratio_threshold,
                                           const int neighbor_offset, cv::Mat &labels,
                                           std::vector<std::vector<cv::Point2i>> &components)
 {
+    RunComponents run_components;
+    get_connected_components(swt_image, stroke_width_ratio_threshold, neighbor_offset, labels, run_components);
+
+    size_t first_component = components.size();
+    components.resize(first_component + run_components.size());
+    cv::parallel_for_(cv::Range(0, (int)run_components.size()), [&](const cv::Range &range) {
+        for (int c = range.start; c < range.end; c++) {
+            components[first_component + c].reserve(run_components.pixel_count(c));
+            run_components.append_points(c, components[first_component + c]);
+        }
+    }, swt_num_stripes(run_components.size()));
+}
 
-    PosStrokeWidth temp;
-    unsigned int curr_label = 1;
-    labels.setTo(cv::Scalar(0));
-    std::vector<PosStrokeWidth> neighbors;
-    std::vector<cv::Point2i> temp_component;
-
-    //LOOP OVER THE IMAGE
-    for (int i = 0; i < swt_image.rows; i++) {
-        for (int j = 0; j < swt_image.cols; j++) {
-            //first skip all stroke width zeros and already labeled pixels
-            if ((swt_image.at<float>(i,j) != 0) && (labels.at<unsigned short>(i,j) == 0)){
+//===============================================================================
+// encode_runs()
+//-------------------------------------------------------------------------------
+// Run-length encodes components given as points, in any order. The component
+// at index c gets the label c + 1.
+//
+// parameters:
+//  - components: vector of vectors of points (x = col, y = row)
+//  - run_components: output with the runs of the components
+// return: void
+//===============================================================================
+void algorithms::encode_runs(const std::vector<std::vector<cv::Point2i>> &components, RunComponents &run_components)
+{
+    run_components = RunComponents();
+    std::vector<cv::Point2i> points;
+    for (size_t c = 0; c < components.size(); c++) {
+        points = components[c];
+        std::sort(points.begin(), points.end(), [](const cv::Point2i &a, const cv::Point2i &b) {
+            return (a.y < b.y) || ((a.y == b.y) && (a.x < b.x));
+        });
+
+        for (size_t begin = 0; begin < points.size();) {
+            size_t end = begin + 1;
+            while ((end < points.size()) && (points[end].y == points[begin].y) &&
+                   (points[end].x == points[end - 1].x + 1)) {
+                end++;
+            }
+            Run run = {points[begin].y, points[begin].x, points[end - 1].x + 1, (int)c + 1};
+            run_components.runs.push_back(run);
+            begin = end;
+        }
+        run_components.first_run.push_back(run_components.runs.size());
+    }
+}
 
-                //now add the first pixel to a component, then a recursion finds all connected pixels, then a new component gets a new label_cnt
-                temp.col = j;
-                temp.row = i;
-                temp.stroke_width = swt_image.at<float>(i,j);
-                neighbors.clear();
-                neighbors.push_back(temp);
-                // the first element can only be valid.
+//===============================================================================
+// get_connected_components()
+//-------------------------------------------------------------------------------
+// Labels the components like above and collects their features in the same
+// pass that writes the labels, so the later stages do not have to visit the
+// pixels again. The width histograms are left to discard_non_text(), which
+// only needs them for the components that pass its box checks.
+//
+// parameters:
+//  - input_image: [CV_8UC3] matrix with the input image for the color sums
+//  - stats: output vector with the features of every component
+//  - see get_connected_components() above for the others
+// return: void
+//===============================================================================
+void algorithms::get_connected_components(const cv::Mat &swt_image, const cv::Mat &input_image,
+                                          const float stroke_width_ratio_threshold, const int neighbor_offset,
+                                          cv::Mat &labels, RunComponents &components,
+                                          std::vector<ComponentStats> &stats)
+{
+    label_components(swt_image, input_image, stroke_width_ratio_threshold, neighbor_offset, labels, components, &stats);
+}
 
-                //iterate over neighbors
-                while (neighbors.size() > 0){
-                    //take out one element from the neighborhood list and perform all checks
+//histogram and variance of the stroke widths of one component. The variance is
+//updated bin by bin with Welford's method, weighted with the bin counts
+static void collect_width_distribution(const cv::Mat &swt_image, const algorithms::RunComponents &components,
+                                       const size_t component, std::vector<float> &widths,
+                                       std::vector<std::pair<float, int>> &histogram, double &variance)
+{
+    widths.clear();
+    for (const algorithms::Run *run = components.begin(component); run != components.end(component); run++) {
+        const float *swt_row = swt_image.ptr<float>(run->row);
+        widths.insert(widths.end(), swt_row + run->col_begin, swt_row + run->col_end);
+    }
 
-                    auto neighbor_to_check = neighbors.back();
-                    neighbors.pop_back();
-                   //now find neighbors of candidate and also put them on the neigbor list
-                            for (int k = (neighbor_to_check.row - neighbor_offset); k < (neighbor_to_check.row + neighbor_offset +1); ++k) {
-                                for (int l = (neighbor_to_check.col - neighbor_offset); l < (neighbor_to_check.col + neighbor_offset +1); ++l) {
-                                    //add all neighbours to queue
-                                    if ((k >= 0) && (l>= 0) && (k< swt_image.rows) && (l< swt_image.cols)) {
-                                        if ((labels.at<unsigned short>(k, l) == 0) && (swt_image.at<float>(k, l) != 0)) {
+    helper::stroke_width_histogram(widths.data(), widths.size(), histogram);
 
-                                            temp.col = l;
-                                            temp.row = k;
-                                            temp.stroke_width = swt_image.at<float>(k, l);
+    double mean = 0;
+    double square_deviations = 0;
+    long long count = 0;
+    for (const std::pair<float, int> &bin : histogram) {
+        count += bin.second;
+        double delta = bin.first - mean;
+        mean += delta * bin.second / count;
+        square_deviations += delta * (bin.first - mean) * bin.second;
+    }
+    variance = (count > 0) ? square_deviations / count : 0;
+}
 
-                                            double stroke_ratio = neighbor_to_check.stroke_width / temp.stroke_width;
-                                            if ((stroke_ratio > (1/stroke_width_ratio_threshold)) && (stroke_ratio < stroke_width_ratio_threshold)) {
-                                                labels.at<unsigned short>(temp.row,temp.col) = curr_label;
-                                                temp_component.push_back(cv::Point2i(temp.col, temp.row));
-                                                neighbors.push_back(temp);
-                                            }
-                                        }
-                                    }
-                                }
+//===============================================================================
+// compute_component_stats()
+//-------------------------------------------------------------------------------
+// Collects the features of every component in one walk over its runs:
+// bounding box, pixel count, sum of the stroke widths and sum of the input
+// colors. The histogram and the variance of the stroke widths need a second
+// walk, so they are optional. Components are processed in parallel.
+//
+// parameters:
+//  - swt_image: [CV_32FC1] matrix with the stroke widths
+//  - input_image: [CV_8UC3] matrix with the input image, the color sums stay 0 otherwise
+//  - components: the runs of the components
+//  - stats: output vector with the features of every component
+//  - width_distributions: false leaves the width histograms empty and the variances 0
+// return: void
+//===============================================================================
+void algorithms::compute_component_stats(const cv::Mat &swt_image, const cv::Mat &input_image,
+                                         const RunComponents &components, std::vector<ComponentStats> &stats,
+                                         const bool width_distributions)
+{
+    stats.assign(components.size(), ComponentStats());
+    const bool has_colors = (input_image.type() == CV_8UC3) && (input_image.size() == swt_image.size());
+
+    cv::parallel_for_(cv::Range(0, (int)components.size()), [&](const cv::Range &range) {
+        std::vector<float> widths;
+        for (int c = range.start; c < range.end; c++) {
+            ComponentStats &component_stats = stats[c];
+            if (components.begin(c) == components.end(c)) {
+                continue;
+            }
 
+            cv::Point2i min_point(INT_MAX, INT_MAX);
+            cv::Point2i max_point(INT_MIN, INT_MIN);
+            for (const Run *run = components.begin(c); run != components.end(c); run++) {
+                min_point.x = std::min(min_point.x, run->col_begin);
+                min_point.y = std::min(min_point.y, run->row);
+                max_point.x = std::max(max_point.x, run->col_end - 1);
+                max_point.y = std::max(max_point.y, run->row);
+
+                const float *swt_row = swt_image.ptr<float>(run->row);
+                for (int col = run->col_begin; col < run->col_end; col++) {
+                    component_stats.width_sum += swt_row[col];
+                }
+                component_stats.pixel_count += run->col_end - run->col_begin;
+                if (has_colors) {
+                    const cv::Vec3b *color_row = input_image.ptr<cv::Vec3b>(run->row);
+                    for (int col = run->col_begin; col < run->col_end; col++) {
+                        for (int channel = 0; channel < 3; channel++) {
+                            component_stats.color_sum[channel] += color_row[col][channel];
+                        }
                     }
+                }
+            }
+            component_stats.bounding_box = cv::Rect2i(min_point.x, min_point.y, max_point.x - min_point.x + 1,
+                                                      max_point.y - min_point.y + 1);
 
+            if (width_distributions) {
+                collect_width_distribution(swt_image, components, c, widths, component_stats.width_histogram,
+                                           component_stats.width_variance);
+            }
+        }
+    }, swt_num_stripes(components.size()));
+}
 
-               }
-
-
-               //all done: add component to components and find next component
-               components.push_back(temp_component);
-               temp_component.clear();
+//features of components given as points
+void algorithms::compute_component_stats(const cv::Mat &swt_image, const cv::Mat &input_image,
+                                         const std::vector<std::vector<cv::Point2i>> &components,
+                                         std::vector<ComponentStats> &stats)
+{
+    RunComponents run_components;
+    encode_runs(components, run_components);
+    compute_component_stats(swt_image, input_image, run_components, stats);
+}
 
-               curr_label ++;
+#if SWT_AVX2
+//min and max of x and y over count points, four points per step
+__attribute__((target("avx2"))) static void points_extent_avx2(const cv::Point2i *points, const size_t count,
+                                                               cv::Point2i &min_point, cv::Point2i &max_point)
+{
+    //lanes hold x, y, x, y, ...
+    const int *coordinates = reinterpret_cast<const int *>(points);
+    __m256i min_xy = _mm256_setr_epi32(min_point.x, min_point.y, min_point.x, min_point.y, min_point.x, min_point.y,
+                                       min_point.x, min_point.y);
+    __m256i max_xy = _mm256_setr_epi32(max_point.x, max_point.y, max_point.x, max_point.y, max_point.x, max_point.y,
+                                       max_point.x, max_point.y);
+    size_t k = 0;
+    for (; k + 4 <= count; k += 4) {
+        __m256i xy = _mm256_loadu_si256((const __m256i *)(coordinates + 2 * k));
+        min_xy = _mm256_min_epi32(min_xy, xy);
+        max_xy = _mm256_max_epi32(max_xy, xy);
+    }
 
+    alignas(32) int min_lanes[8], max_lanes[8];
+    _mm256_store_si256((__m256i *)min_lanes, min_xy);
+    _mm256_store_si256((__m256i *)max_lanes, max_xy);
+    for (int lane = 0; lane < 8; lane += 2) {
+        min_point.x = std::min(min_point.x, min_lanes[lane]);
+        min_point.y = std::min(min_point.y, min_lanes[lane + 1]);
+        max_point.x = std::max(max_point.x, max_lanes[lane]);
+        max_point.y = std::max(max_point.y, max_lanes[lane + 1]);
+    }
+    for (; k < count; k++) {
+        min_point.x = std::min(min_point.x, points[k].x);
+        min_point.y = std::min(min_point.y, points[k].y);
+        max_point.x = std::max(max_point.x, points[k].x);
+        max_point.y = std::max(max_point.y, points[k].y);
+    }
+}
+#endif
 
-            }
+//bounding box of the points, empty if there are none
+static cv::Rect2i points_bounding_box(const std::vector<cv::Point2i> &points)
+{
+    if (points.empty()) {
+        return cv::Rect2i();
+    }
 
+    cv::Point2i min_point(INT_MAX, INT_MAX);
+    cv::Point2i max_point(INT_MIN, INT_MIN);
+#if SWT_AVX2
+    static const bool vectorized = __builtin_cpu_supports("avx2");
+    if (vectorized && (sizeof(cv::Point2i) == 2 * sizeof(int))) {
+        points_extent_avx2(points.data(), points.size(), min_point, max_point);
+    } else
+#endif
+    {
+        for (const cv::Point2i &point : points) {
+            min_point.x = std::min(min_point.x, point.x);
+            min_point.y = std::min(min_point.y, point.y);
+            max_point.x = std::max(max_point.x, point.x);
+            max_point.y = std::max(max_point.y, point.y);
         }
     }
+    return cv::Rect2i(min_point.x, min_point.y, max_point.x - min_point.x + 1, max_point.y - min_point.y + 1);
 }
 
 //===============================================================================
@@ -389,35 +1918,136 @@ void algorithms::get_connected_components(const cv::Mat &swt_image, const float
 // hint: - save a rectangle in order (x = col, y = row, width, height)
 //       - use the the mathematical functions provided by the standard library
 //
+// One pass per component with a min/max reduction over x and y, AVX2 if the
+// CPU supports it. The components are processed in parallel, an empty
+// component gets an empty box.
+//
 // parameters:
 //  - components: vector of vectors of points (x = col, y = row)
-//  - bounding_boxes: output vector of rectangles (x = col, y = row, width, height)
+//  - bounding_boxes: output vector of rectangles (x = col, y = row, width, height), appended
 // return: void
 //===============================================================================
-//compare functions for cv::point
-bool sortby_x(const cv::Point2i& a, const cv::Point2i& b)
+void algorithms::compute_bounding_boxes(const std::vector<std::vector<cv::Point2i>> &components,
+                                        std::vector<cv::Rect2i> &bounding_boxes)
 {
-    return (a.x < b.x);
+    const size_t first = bounding_boxes.size();
+    bounding_boxes.resize(first + components.size());
+    cv::parallel_for_(cv::Range(0, (int)components.size()), [&](const cv::Range &range) {
+        for (int c = range.start; c < range.end; c++) {
+            bounding_boxes[first + c] = points_bounding_box(components[c]);
+        }
+    });
 }
-bool sortby_y(const cv::Point2i& a, const cv::Point2i& b)
+
+//===============================================================================
+// compute_bounding_boxes()
+//-------------------------------------------------------------------------------
+// Bounding boxes of run-length encoded components. The rows come from the
+// first and last run, since the runs are in raster order, the columns from
+// the run ends.
+//
+// parameters:
+//  - components: runs of the components
+//  - bounding_boxes: output vector of rectangles (x = col, y = row, width, height), appended
+// return: void
+//===============================================================================
+void algorithms::compute_bounding_boxes(const RunComponents &components, std::vector<cv::Rect2i> &bounding_boxes)
 {
-    return (a.y < b.y);
+    const size_t first = bounding_boxes.size();
+    bounding_boxes.resize(first + components.size());
+    cv::parallel_for_(cv::Range(0, (int)components.size()), [&](const cv::Range &range) {
+        for (int c = range.start; c < range.end; c++) {
+            if (components.begin(c) == components.end(c)) {
+                bounding_boxes[first + c] = cv::Rect2i();
+                continue;
+            }
+
+            int min_col = INT_MAX;
+            int max_col = INT_MIN;
+            for (const Run *run = components.begin(c); run != components.end(c); run++) {
+                min_col = std::min(min_col, run->col_begin);
+                max_col = std::max(max_col, run->col_end);
+            }
+            const int min_row = components.begin(c)->row;
+            const int max_row = (components.end(c) - 1)->row;
+            bounding_boxes[first + c] = cv::Rect2i(min_col, min_row, max_col - min_col, max_row - min_row + 1);
+        }
+    });
 }
 
-void algorithms::compute_bounding_boxes(const std::vector<std::vector<cv::Point2i>> &components,
+//===============================================================================
+// compute_bounding_boxes()
+//-------------------------------------------------------------------------------
+// Bounding boxes straight from a labels matrix, in one pass over the image.
+// Every row stripe collects its own boxes, which are merged afterwards. There
+// are no more stripes than pixels per component, so the stripe boxes take at
+// most one entry per pixel.
+//
+// parameters:
+//  - labels: [CV_16UC1 or CV_32SC1] matrix with the component labels, 0 for no component
+//  - num_components: number of components, labels 1 to num_components are counted
+//  - bounding_boxes: output vector of rectangles (x = col, y = row, width, height), appended,
+//                    the box of label n at index n - 1
+// return: void
+//===============================================================================
+void algorithms::compute_bounding_boxes(const cv::Mat &labels, const int num_components,
                                         std::vector<cv::Rect2i> &bounding_boxes)
 {
+    CV_Assert((labels.type() == CV_16UC1) || (labels.type() == CV_32SC1));
+    //at most one extent per pixel, like the run strips of get_connected_components()
+    const int num_stripes = (int)std::max(
+        1LL, std::min((long long)std::min(swt_num_stripes((size_t)labels.rows), labels.rows),
+                      (long long)labels.rows * labels.cols / std::max(1, num_components)));
+    auto stripe_row = [&labels, num_stripes](const int stripe) {
+        return (int)((long long)labels.rows * stripe / num_stripes);
+    };
+
+    //min_x, min_y, max_x, max_y of every label and stripe
+    std::vector<cv::Vec4i> stripe_extents((size_t)num_stripes * num_components,
+                                          cv::Vec4i(INT_MAX, INT_MAX, INT_MIN, INT_MIN));
+    cv::parallel_for_(cv::Range(0, num_stripes), [&](const cv::Range &range) {
+        for (int stripe = range.start; stripe < range.end; stripe++) {
+            cv::Vec4i *extents = &stripe_extents[(size_t)stripe * num_components];
+            for (int i = stripe_row(stripe); i < stripe_row(stripe + 1); i++) {
+                for (int j = 0; j < labels.cols; j++) {
+                    int label = (labels.type() == CV_16UC1) ? labels.at<ushort>(i, j) : labels.at<int>(i, j);
+                    if ((label <= 0) || (label > num_components)) {
+                        continue;
+                    }
+                    cv::Vec4i &extent = extents[label - 1];
+                    extent[0] = std::min(extent[0], j);
+                    extent[1] = std::min(extent[1], i);
+                    extent[2] = std::max(extent[2], j);
+                    extent[3] = std::max(extent[3], i);
+                }
+            }
+        }
+    });
+
+    for (int c = 0; c < num_components; c++) {
+        cv::Vec4i extent(INT_MAX, INT_MAX, INT_MIN, INT_MIN);
+        for (int stripe = 0; stripe < num_stripes; stripe++) {
+            const cv::Vec4i &stripe_extent = stripe_extents[(size_t)stripe * num_components + c];
+            extent[0] = std::min(extent[0], stripe_extent[0]);
+            extent[1] = std::min(extent[1], stripe_extent[1]);
+            extent[2] = std::max(extent[2], stripe_extent[2]);
+            extent[3] = std::max(extent[3], stripe_extent[3]);
+        }
+        if (extent[0] > extent[2]) {
+            bounding_boxes.push_back(cv::Rect2i());
+        } else {
+            bounding_boxes.push_back(
+                cv::Rect2i(extent[0], extent[1], extent[2] - extent[0] + 1, extent[3] - extent[1] + 1));
+        }
+    }
+}
 
-
-    for (auto component : components) {
-
-        auto min_col = std::min_element(component.begin(),component.end(),sortby_x);
-        auto max_col = std::max_element(component.begin(),component.end(),sortby_x);
-        auto min_row = std::min_element(component.begin(),component.end(),sortby_y);
-        auto max_row = std::max_element(component.begin(),component.end(),sortby_y);
-
-
-        bounding_boxes.push_back(cv::Rect2i((*min_col).x,(*min_row).y,((*max_col).x-(*min_col).x)+1,((*max_row).y-(*min_row).y+1)));
+//bounding boxes already collected by compute_component_stats()
+void algorithms::compute_bounding_boxes(const std::vector<ComponentStats> &stats,
+                                        std::vector<cv::Rect2i> &bounding_boxes)
+{
+    for (const ComponentStats &component_stats : stats) {
+        bounding_boxes.push_back(component_stats.bounding_box);
     }
 }
 
@@ -432,14 +2062,17 @@ void algorithms::compute_bounding_boxes(const std::vector<std::vector<cv::Point2
 //       - already assigned label numbers should not be changed, e.g. third connected component
 //         will keep label number 3, even though the first and second may have been discarded
 //
+// Collects the features with compute_component_stats() and filters them with the
+// version below.
+//
 // parameters:
 //  -  swt_image: [CV_32FC1] matrix with the stroke widths
 //  -  bounding_boxes: vector with rectangles of the bounding boxes
 //  -  components: vector of vectors of points (x = col, y = row)
-//  -  labels: [CV_16UC1] matrix with component labels for each position
+//  -  labels: [CV_16UC1 or CV_32SC1] matrix with component labels for each position
 //  -  text_bounding_boxes: subset of "bounding_boxes" of recognized text components
 //  -  text_components: subset of "components" of recognized text
-//  -  text_labels: [CV_16UC1] output matrix with a subset of "labels" of recognized text components
+//  -  text_labels: [same type as labels] output matrix with a subset of "labels" of recognized text components
 // return: void
 //===============================================================================
 void algorithms::discard_non_text(const cv::Mat &swt_image, const std::vector<cv::Rect2i> &bounding_boxes,
@@ -449,80 +2082,150 @@ void algorithms::discard_non_text(const cv::Mat &swt_image, const std::vector<cv
                                   std::vector<cv::Rect2i> &text_bounding_boxes,
                                   std::vector<std::vector<cv::Point2i>> &text_components, cv::Mat &text_labels)
 {
-    //iterate over boxes and components together
-    auto box = bounding_boxes.begin();
+    RunComponents run_components;
+    encode_runs(components, run_components);
+    std::vector<ComponentStats> stats;
+    compute_component_stats(swt_image, cv::Mat(), run_components, stats, false);
+    for (size_t i = 0; i < stats.size(); i++) {
+        stats[i].bounding_box = bounding_boxes[i];
+    }
 
-    for (auto component= components.begin() ; component != components.end();++component,++box){
+    RunComponents text_run_components;
+    std::vector<ComponentStats> text_stats;
+    discard_non_text(swt_image, stats, run_components, labels, variance_ratio, aspect_ratio_threshold, diameter_ratio_threshold,
+                     min_height, max_height, text_bounding_boxes, text_run_components, text_labels, text_stats);
+    for (size_t i = 0; i < text_run_components.size(); i++) {
+        text_components.push_back(std::vector<cv::Point2i>());
+        text_run_components.append_points(i, text_components.back());
+    }
+}
 
-        /////////////////////aspect ratio threshold calculation
-        float aspect;
-        if (box->height > 0){
-            aspect = (float)box->width / (float)box->height;
-        }
+//===============================================================================
+// discard_non_text()
+//-------------------------------------------------------------------------------
+// Same as above on the features of compute_component_stats(), as a cascade run
+// in parallel over the components: the box checks come first and only the
+// components that pass them get their width histogram, if it is not there yet.
+// The median comes from the histogram, the variance from Welford's method
+// over the histogram. Only the labels of the kept components are copied, run
+// by run.
+//
+// parameters:
+//  -  stats: features of the components, the bounding boxes included
+//  -  components: the runs of the components
+//  -  text_components: subset of "components" of recognized text, with their original labels
+//  -  text_stats: subset of "stats" of recognized text components, with their width histograms
+//  -  counts: optional output with the number of components removed by each check
+//  -  see discard_non_text() above for the others
+// return: void
+//===============================================================================
+void algorithms::discard_non_text(const cv::Mat &swt_image, const std::vector<ComponentStats> &stats,
+                                  const RunComponents &components, const cv::Mat &labels, const float variance_ratio,
+                                  const float aspect_ratio_threshold, const float diameter_ratio_threshold,
+                                  const int min_height, const int max_height,
+                                  std::vector<cv::Rect2i> &text_bounding_boxes, RunComponents &text_components,
+                                  cv::Mat &text_labels, std::vector<ComponentStats> &text_stats, DiscardCounts *counts)
+{
+    //text labels need the label type of the labels
+    if (text_labels.type() != labels.type()) {
+        text_labels = cv::Mat::zeros(labels.size(), labels.type());
+    }
 
-        bool aspect_correct = ((aspect <= aspect_ratio_threshold) && (aspect >= (float)(1/ aspect_ratio_threshold)));
-        /////////////check height
-        bool height_correct = ((box->height <= max_height) && (box->height >= min_height));
+    //first check a component fails, in the order of the cascade
+    enum Check { KEPT, EMPTY, ASPECT_RATIO, HEIGHT, DIAMETER_RATIO, VARIANCE_RATIO };
+    std::vector<unsigned char> failed_check(stats.size(), KEPT);
+    //width distributions of the components that came without them
+    std::vector<std::vector<std::pair<float, int>>> width_histograms(stats.size());
+    std::vector<double> width_variances(stats.size(), 0);
+
+    cv::parallel_for_(cv::Range(0, (int)stats.size()), [&](const cv::Range &range) {
+        std::vector<float> widths;
+        for (int i = range.start; i < range.end; i++) {
+            const ComponentStats &component_stats = stats[i];
+            const cv::Rect2i &box = component_stats.bounding_box;
+            if (component_stats.pixel_count == 0) {
+                failed_check[i] = EMPTY;
+                continue;
+            }
 
-        //////////////calculate median of stroke widths for later
-        //copy over stroke widths
-        std::vector<float> temporary_ray_width;
-        for (auto point : (*component)) {
-            temporary_ray_width.push_back(swt_image.at<float>(point));
-        }
+            /////////////////////aspect ratio threshold calculation
+            float aspect = 0;
+            if (box.height > 0) {
+                aspect = (float)box.width / (float)box.height;
+            }
+            if ((aspect > aspect_ratio_threshold) || (aspect < (float)(1 / aspect_ratio_threshold))) {
+                failed_check[i] = ASPECT_RATIO;
+                continue;
+            }
 
-        float median;
-        std::sort(temporary_ray_width.begin(),temporary_ray_width.end());
-        unsigned long size_of_ray = temporary_ray_width.size();
-        unsigned long size_half = floor(size_of_ray /2 );
+            /////////////check height
+            if ((box.height > max_height) || (box.height < min_height)) {
+                failed_check[i] = HEIGHT;
+                continue;
+            }
 
-        if (size_of_ray % 2 == 0){ // even
-            median = (temporary_ray_width[size_half]+temporary_ray_width[size_half-1])/2;
-        }else{ //odd
-            median = temporary_ray_width[size_half];
-        }
+            //the width checks need the histogram
+            const std::vector<std::pair<float, int>> *histogram = &component_stats.width_histogram;
+            double variance = component_stats.width_variance;
+            if (histogram->empty()) {
+                collect_width_distribution(swt_image, components, i, widths, width_histograms[i],
+                                           width_variances[i]);
+                histogram = &width_histograms[i];
+                variance = width_variances[i];
+            }
 
-        ////////////////////////////diameter ratio threshold:
-        bool diameter_ratio_correct;
-        if (median > 0) {
-             diameter_ratio_correct = ((float) (std::sqrt(std::pow(box->height, 2) + std::pow(box->width, 2)) / median) <= diameter_ratio_threshold);
-        }
-        //////////////////////////variance ratio threshold:
-        //mean calculation
-        double sum = 0;
-        for(auto val : temporary_ray_width){
-            sum += val;
-        }
+            ////////////////////////////diameter ratio threshold:
+            float median = helper::median(*histogram, component_stats.pixel_count);
+            if (!((median > 0) &&
+                  ((float)(std::sqrt(std::pow(box.height, 2) + std::pow(box.width, 2)) / median) <=
+                   diameter_ratio_threshold))) {
+                failed_check[i] = DIAMETER_RATIO;
+                continue;
+            }
 
-        double mean;
-        if ( temporary_ray_width.size() > 0) {
-            mean = sum / temporary_ray_width.size();
+            //////////////////////////variance ratio threshold:
+            if (!(variance <= (variance_ratio * median))) {
+                failed_check[i] = VARIANCE_RATIO;
+            }
         }
-        //variance calc
-
-        double variance = 0;
-        for(auto val : temporary_ray_width){
-            variance += std::pow(val - mean, 2);
+    }, swt_num_stripes(stats.size()));
+
+    DiscardCounts discard_counts;
+    for (size_t i = 0; i < stats.size(); i++) {
+        const unsigned char check = failed_check[i];
+        discard_counts.empty += (check == EMPTY);
+        discard_counts.aspect_ratio += (check == ASPECT_RATIO);
+        discard_counts.height += (check == HEIGHT);
+        discard_counts.diameter_ratio += (check == DIAMETER_RATIO);
+        discard_counts.variance_ratio += (check == VARIANCE_RATIO);
+        if (check != KEPT) {
+            continue;
         }
-        if ( temporary_ray_width.size() > 0) {
-            variance = variance / temporary_ray_width.size();
+        discard_counts.kept++;
+
+        /////////////store the letter
+        text_components.push_back(components.begin(i), components.end(i));
+        text_bounding_boxes.push_back(stats[i].bounding_box);
+        text_stats.push_back(stats[i]);
+        if (text_stats.back().width_histogram.empty()) {
+            text_stats.back().width_histogram.swap(width_histograms[i]);
+            text_stats.back().width_variance = width_variances[i];
         }
 
-        bool variance_ratio_correct = (variance <= (variance_ratio * median));
-
-        /////////////check if letter is valid & store into letters
-        if  ((diameter_ratio_correct && variance_ratio_correct && height_correct && aspect_correct)){
-            text_components.push_back(*component);
-            text_bounding_boxes.push_back(*box);
-
-            for (auto pt : (*component)){
-                text_labels.at<unsigned short>(pt) = labels.at<unsigned short>(pt);
+        for (const Run *run = components.begin(i); run != components.end(i); run++) {
+            if (labels.type() == CV_32SC1) {
+                std::copy(labels.ptr<int>(run->row) + run->col_begin, labels.ptr<int>(run->row) + run->col_end,
+                          text_labels.ptr<int>(run->row) + run->col_begin);
+            } else {
+                std::copy(labels.ptr<unsigned short>(run->row) + run->col_begin,
+                          labels.ptr<unsigned short>(run->row) + run->col_end,
+                          text_labels.ptr<unsigned short>(run->row) + run->col_begin);
             }
-
         }
-
     }
-
+    if (counts != nullptr) {
+        *counts = discard_counts;
+    }
 }
 
 //================================================================================
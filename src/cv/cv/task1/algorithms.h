@@ -1,12 +1,111 @@
 #ifndef CGCV_ALGORITHMS_H
 #define CGCV_ALGORITHMS_H
 
-#include "helper.h"
 #include <opencv2/opencv.hpp>
 
 class algorithms
 {
    public:
+    // accepted SWT ray: only the end points are stored, the pixels in between
+    // are re-marched on demand with swt_ray_pixels()
+    struct Ray
+    {
+        cv::Point2i start;
+        cv::Point2i end;
+        cv::Point2f direction;  // gradient direction, already flipped for black on white
+        int length;             // number of pixels, start and end included
+
+        bool operator==(const Ray &other) const
+        {
+            return (start == other.start) && (end == other.end) && (direction == other.direction) &&
+                   (length == other.length);
+        }
+    };
+    typedef std::vector<Ray> RayList;
+
+    // edge pixel of the Canny map with the gradient direction at it
+    struct EdgePixel
+    {
+        cv::Point2i position;
+        cv::Point2f gradient;
+    };
+    typedef std::vector<EdgePixel> EdgeList;
+
+    // limits of swt_compute_stroke_width, 0 means unlimited
+    struct SwtLimits
+    {
+        int max_ray_length = 0;       // rays with more pixels are dropped, start and end included
+        long long max_rays = 0;       // accepted rays per image
+        long long max_ray_steps = 0;  // marched pixels per image, accepted or not
+    };
+
+    // horizontal run of pixels of one component, col_end excluded
+    struct Run
+    {
+        int row;
+        int col_begin;
+        int col_end;
+        int label;  // value of the pixels in the labels matrix
+    };
+
+    // run-length encoded components: the runs of the component at index c are
+    // runs[first_run[c]] to runs[first_run[c + 1] - 1], in raster order
+    struct RunComponents
+    {
+        std::vector<Run> runs;
+        std::vector<size_t> first_run = std::vector<size_t>(1, 0);
+
+        size_t size() const { return first_run.size() - 1; }
+        const Run *begin(size_t component) const { return runs.data() + first_run[component]; }
+        const Run *end(size_t component) const { return runs.data() + first_run[component + 1]; }
+
+        int pixel_count(size_t component) const
+        {
+            int count = 0;
+            for (const Run *run = begin(component); run != end(component); run++)
+                count += run->col_end - run->col_begin;
+            return count;
+        }
+
+        // appends the points of a component in raster order
+        void append_points(size_t component, std::vector<cv::Point2i> &points) const
+        {
+            for (const Run *run = begin(component); run != end(component); run++)
+                for (int col = run->col_begin; col < run->col_end; col++)
+                    points.push_back(cv::Point2i(col, run->row));
+        }
+
+        // appends a component given by its runs
+        void push_back(const Run *first, const Run *last)
+        {
+            runs.insert(runs.end(), first, last);
+            first_run.push_back(runs.size());
+        }
+    };
+
+    // features of a connected component, collected once after labelling
+    struct ComponentStats
+    {
+        cv::Rect2i bounding_box;
+        int pixel_count = 0;
+        double width_sum = 0;       // sum of the stroke widths
+        double width_variance = 0;  // variance of the stroke widths, collected with the histogram
+        std::vector<std::pair<float, int>> width_histogram;  // distinct stroke widths, ascending, with their counts
+        cv::Vec3d color_sum;        // sum of the input image colors in its channel order, CV_8UC3 only
+    };
+
+    // components removed by each check of discard_non_text(), every component
+    // is counted at the first check it fails
+    struct DiscardCounts
+    {
+        int empty = 0;
+        int aspect_ratio = 0;
+        int height = 0;
+        int diameter_ratio = 0;
+        int variance_ratio = 0;
+        int kept = 0;
+    };
+
     static void compute_grayscale(const cv::Mat &input_image, cv::Mat &grayscale_image);
 
     static void compute_gradient(const cv::Mat &grayscale_image, cv::Mat &gradient_x, cv::Mat &gradient_y,
@@ -15,20 +114,64 @@ class algorithms
     static void compute_directions(const cv::Mat &gradient_x, const cv::Mat &gradient_y, const cv::Mat &gradient_abs,
                                    cv::Mat &direction_x, cv::Mat &direction_y);
 
+    static void extract_edge_pixels(const cv::Mat &edges, const cv::Mat &direction_x, const cv::Mat &direction_y,
+                                    EdgeList &edge_pixels);
+
     static void swt_compute_stroke_width(const cv::Mat &edges, const cv::Mat &direction_x, const cv::Mat &direction_y,
-                                         bool black_on_white, std::vector<std::vector<cv::Point2i>> &rays,
+                                         bool black_on_white, const SwtLimits &limits, RayList &rays,
                                          cv::Mat &swt_stroke_width_image);
 
-    static void swt_postprocessing(const cv::Mat &swt_stroke_width_image,
-                                   const std::vector<std::vector<cv::Point2i>> &rays, cv::Mat &swt_final_image);
+    static void swt_compute_stroke_width_dual(const cv::Mat &edges, const cv::Mat &direction_x,
+                                              const cv::Mat &direction_y, const SwtLimits &limits,
+                                              RayList &black_on_white_rays, cv::Mat &black_on_white_image,
+                                              RayList &white_on_black_rays, cv::Mat &white_on_black_image);
+
+    static void swt_set_vectorized(bool enabled);
+
+    static bool swt_vectorized();
+
+    static void swt_ray_pixels(const Ray &ray, std::vector<cv::Point2i> &pixels);
+
+    static void swt_postprocessing(const cv::Mat &swt_stroke_width_image, const RayList &rays,
+                                   cv::Mat &swt_final_image);
 
     static void get_connected_components(const cv::Mat &swt_image, const float stroke_width_ratio_threshold,
                                          const int neighbor_offset, cv::Mat &labels,
                                          std::vector<std::vector<cv::Point2i>> &components);
 
+    static void get_connected_components(const cv::Mat &swt_image, const float stroke_width_ratio_threshold,
+                                         const int neighbor_offset, cv::Mat &labels, RunComponents &components);
+
+    static void get_connected_components(const cv::Mat &swt_image, const cv::Mat &input_image,
+                                         const float stroke_width_ratio_threshold, const int neighbor_offset,
+                                         cv::Mat &labels, RunComponents &components,
+                                         std::vector<ComponentStats> &stats);
+
+    static void encode_runs(const std::vector<std::vector<cv::Point2i>> &components, RunComponents &run_components);
+
+    static void get_connected_components_flood_fill(const cv::Mat &swt_image, const float stroke_width_ratio_threshold,
+                                                    const int neighbor_offset, cv::Mat &labels,
+                                                    std::vector<std::vector<cv::Point2i>> &components);
+
+    static void compute_component_stats(const cv::Mat &swt_image, const cv::Mat &input_image,
+                                        const std::vector<std::vector<cv::Point2i>> &components,
+                                        std::vector<ComponentStats> &stats);
+
+    static void compute_component_stats(const cv::Mat &swt_image, const cv::Mat &input_image,
+                                        const RunComponents &components, std::vector<ComponentStats> &stats,
+                                        const bool width_distributions = true);
+
     static void compute_bounding_boxes(const std::vector<std::vector<cv::Point2i>> &components,
                                        std::vector<cv::Rect2i> &bounding_boxes);
 
+    static void compute_bounding_boxes(const RunComponents &components, std::vector<cv::Rect2i> &bounding_boxes);
+
+    static void compute_bounding_boxes(const cv::Mat &labels, const int num_components,
+                                       std::vector<cv::Rect2i> &bounding_boxes);
+
+    static void compute_bounding_boxes(const std::vector<ComponentStats> &stats,
+                                       std::vector<cv::Rect2i> &bounding_boxes);
+
     static void discard_non_text(const cv::Mat &swt_image, const std::vector<cv::Rect2i> &bounding_boxes,
                                  const std::vector<std::vector<cv::Point2i>> &components, const cv::Mat &labels,
                                  const float variance_ratio, const float aspect_ratio_threshold,
@@ -36,6 +179,14 @@ class algorithms
                                  std::vector<cv::Rect2i> &text_bounding_boxes,
                                  std::vector<std::vector<cv::Point2i>> &text_components, cv::Mat &text_labels);
 
+    static void discard_non_text(const cv::Mat &swt_image, const std::vector<ComponentStats> &stats,
+                                 const RunComponents &components, const cv::Mat &labels, const float variance_ratio,
+                                 const float aspect_ratio_threshold, const float diameter_ratio_threshold,
+                                 const int min_height, const int max_height,
+                                 std::vector<cv::Rect2i> &text_bounding_boxes, RunComponents &text_components,
+                                 cv::Mat &text_labels, std::vector<ComponentStats> &text_stats,
+                                 DiscardCounts *counts = nullptr);
+
     struct PosStrokeWidth
     {
         int col;
@@ -3,67 +3,458 @@
 
 #include "opencv2/opencv.hpp"
 
-//===============================================================================
-// merge()
-//-------------------------------------------------------------------------------
-// TODO:
-//  - Nothing!
-//  - Do not change anything here
-//===============================================================================
-// source: https://www.geeksforgeeks.org/connected-components-in-an-undirected-graph/
-int merge(int* parent, int x)
-{
-    if (parent[x] == x)
-        return x;
-    return merge(parent, parent[x]);
-}
+#include <climits>
 
 //===============================================================================
 // connected_letters()
 //-------------------------------------------------------------------------------
-// TODO:
-//  - Nothing!
-//  - Do not change anything here
+// Groups the letters connected by the edges with a union-find on the heap,
+// with path halving and union by rank. The groups are ordered like in the
+// recursive version this replaces: that one made the root of the second
+// letter of an edge the root of both, and sorted the groups by their root.
+// That root is carried along as the label of every set. The letters of a
+// group are ascending.
+//
+// parameters:
+//  - n: number of letters
+//  - edges: pairs of connected letters
+//  - groups: output with the letter groups, single letters included
+// return: void
 //===============================================================================
-std::vector<std::vector<int>> helper::connected_letters(int n, std::vector<std::vector<int>>& edges)
+void helper::connected_letters(const int n, const std::vector<std::pair<int, int>> &edges, LetterGroups &groups)
 {
-    int parent[n];
+    std::vector<int> parent(n);
+    std::vector<int> rank(n, 0);
+    std::vector<int> label(n);
     for (int i = 0; i < n; i++)
     {
         parent[i] = i;
+        label[i] = i;
     }
-    for (auto x : edges)
+    auto find_root = [&](int letter) {
+        while (parent[letter] != letter)
+        {
+            parent[letter] = parent[parent[letter]];
+            letter = parent[letter];
+        }
+        return letter;
+    };
+
+    for (const std::pair<int, int> &edge : edges)
     {
-        parent[merge(parent, x[0])] = merge(parent, x[1]);
+        int first = find_root(edge.first);
+        int second = find_root(edge.second);
+        if (first == second)
+            continue;
+
+        const int second_label = label[second];
+        if (rank[first] < rank[second])
+            std::swap(first, second);
+        parent[second] = first;
+        rank[first] += (rank[first] == rank[second]);
+        label[first] = second_label;
     }
-    int ans = 0;
+
+    // the label of a set is one of its letters, so the groups come in the order of their labels
+    std::vector<int> group_of_root(n, -1);
+    std::vector<int> roots(n);
+    int num_groups = 0;
     for (int i = 0; i < n; i++)
     {
-        ans += (parent[i] == i);
+        roots[i] = find_root(i);
     }
     for (int i = 0; i < n; i++)
     {
-        parent[i] = merge(parent, parent[i]);
+        if (label[roots[i]] == i)
+            group_of_root[roots[i]] = num_groups++;
     }
-    std::map<int, std::list<int>> m;
+
+    groups.first.assign(num_groups + 1, 0);
     for (int i = 0; i < n; i++)
     {
-        m[parent[i]].push_back(i);
+        groups.first[group_of_root[roots[i]] + 1]++;
+    }
+    for (int group = 0; group < num_groups; group++)
+    {
+        groups.first[group + 1] += groups.first[group];
     }
+    groups.members.resize(n);
+    std::vector<int> next(groups.first.begin(), groups.first.end() - 1);
+    for (int i = 0; i < n; i++)
+    {
+        groups.members[next[group_of_root[roots[i]]]++] = i;
+    }
+}
+
+//===============================================================================
+// connected_letters()
+//-------------------------------------------------------------------------------
+// Same as above with the edges and the groups as vectors.
+//===============================================================================
+std::vector<std::vector<int>> helper::connected_letters(int n, std::vector<std::vector<int>>& edges)
+{
+    std::vector<std::pair<int, int>> edge_pairs;
+    for (const std::vector<int> &edge : edges)
+    {
+        edge_pairs.push_back(std::make_pair(edge[0], edge[1]));
+    }
+    LetterGroups letter_groups;
+    connected_letters(n, edge_pairs, letter_groups);
 
     std::vector<std::vector<int>> groups;
+    for (size_t group = 0; group < letter_groups.size(); group++)
+    {
+        groups.push_back(std::vector<int>(letter_groups.begin(group), letter_groups.end(group)));
+    }
+    return groups;
+}
+
+//===============================================================================
+// stroke_width_table()
+//-------------------------------------------------------------------------------
+// Every stroke width a ray can have: entry n is (float)sqrt(n), the width of a
+// ray with dx^2 + dy^2 = n, computed like in swt_compute_stroke_width.
+//===============================================================================
+static const std::vector<float> &stroke_width_table()
+{
+    // widths up to about 362 pixels
+    static const std::vector<float> table = []() {
+        std::vector<float> widths(1 << 17);
+        for (size_t n = 0; n < widths.size(); n++)
+        {
+            widths[n] = (float)std::sqrt((double)n);
+        }
+        return widths;
+    }();
+    return table;
+}
+
+// table indices of the widths, n = dx^2 + dy^2. Other values, like the mean of
+// two widths left by swt_postprocessing, are kept aside
+static void stroke_width_keys(const float *values, const size_t count, std::vector<unsigned int> &keys,
+                              std::vector<float> &others, unsigned int &min_key, unsigned int &max_key)
+{
+    const std::vector<float> &table = stroke_width_table();
+    keys.reserve(count);
+    min_key = UINT_MAX;
+    max_key = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        double square = (double)values[i] * values[i];
+        unsigned int key = (square < table.size() - 1) ? (unsigned int)std::lround(square) : 0;
+        if ((square < table.size() - 1) && (table[key] == values[i]))
+        {
+            keys.push_back(key);
+            min_key = std::min(min_key, key);
+            max_key = std::max(max_key, key);
+        }
+        else
+        {
+            others.push_back(values[i]);
+        }
+    }
+}
 
-    for (auto it = m.begin(); it != m.end(); it++)
+//===============================================================================
+// median()
+//-------------------------------------------------------------------------------
+// Median of stroke widths: the middle value, or the mean of the two middle
+// values for an even count. Short lists are sorted by insertion. Longer ones
+// are counting-sorted over the index of each width in stroke_width_table(),
+// if nearly every value is such a width and their indices lie close together.
+// Otherwise std::nth_element selects the middle values. The values may be
+// reordered.
+//
+// parameters:
+//  - values: the stroke widths
+//  - count: number of widths, at least 1
+// return: the median
+//===============================================================================
+float helper::median(float *values, const size_t count)
+{
+    const size_t half = count / 2;
+    if (count <= 32)
     {
-        std::list<int> l = it->second;
-        std::vector<int> group;
-        for (auto x : l)
+        for (size_t i = 1; i < count; i++)
         {
-            group.push_back(x);
+            float value = values[i];
+            size_t j = i;
+            for (; (j > 0) && (values[j - 1] > value); j--)
+            {
+                values[j] = values[j - 1];
+            }
+            values[j] = value;
+        }
+        if (count % 2 == 0)
+        {
+            return (values[half] + values[half - 1]) / 2;
         }
-        groups.push_back(group);
+        return values[half];
+    }
+
+    // the other values are few for stroke widths
+    const std::vector<float> &table = stroke_width_table();
+    std::vector<unsigned int> keys;
+    std::vector<float> others;
+    unsigned int min_key;
+    unsigned int max_key;
+    stroke_width_keys(values, count, keys, others, min_key, max_key);
+
+    if (!keys.empty() && (others.size() <= count / 8) && (max_key - min_key <= 4 * count))
+    {
+        std::vector<unsigned int> histogram(max_key - min_key + 1, 0);
+        for (unsigned int key : keys)
+        {
+            histogram[key - min_key]++;
+        }
+        std::sort(others.begin(), others.end());
+
+        // value at a sorted position, merging the histogram with the other values
+        auto value_at = [&](const size_t position) {
+            size_t seen = 0;
+            size_t key = 0;
+            size_t other = 0;
+            while (true)
+            {
+                if ((other < others.size()) &&
+                    ((key == histogram.size()) || (others[other] < table[min_key + key])))
+                {
+                    if (seen == position)
+                    {
+                        return others[other];
+                    }
+                    seen++;
+                    other++;
+                }
+                else
+                {
+                    if (position < seen + histogram[key])
+                    {
+                        return table[min_key + key];
+                    }
+                    seen += histogram[key];
+                    key++;
+                }
+            }
+        };
+
+        if (count % 2 == 0)
+        {
+            return (value_at(half) + value_at(half - 1)) / 2;
+        }
+        return value_at(half);
+    }
+
+    std::nth_element(values, values + half, values + count);
+    if (count % 2 == 0)
+    {
+        // the lower middle value is the largest one in front of the upper one
+        return (values[half] + *std::max_element(values, values + half)) / 2;
+    }
+    return values[half];
+}
+
+//===============================================================================
+// stroke_width_histogram()
+//-------------------------------------------------------------------------------
+// Distinct stroke widths with their counts, ascending, for median() and the
+// width variance. The widths are counted over their index in
+// stroke_width_table() like in median(), only the values that are not in the
+// table are sorted. If the indices spread much wider than the count, the
+// indices are sorted instead of counted.
+//
+// parameters:
+//  - values: the stroke widths
+//  - count: number of widths
+//  - histogram: output with the distinct widths and their counts
+// return: void
+//===============================================================================
+void helper::stroke_width_histogram(const float *values, const size_t count,
+                                    std::vector<std::pair<float, int>> &histogram)
+{
+    const std::vector<float> &table = stroke_width_table();
+    std::vector<unsigned int> keys;
+    std::vector<float> others;
+    unsigned int min_key;
+    unsigned int max_key;
+    stroke_width_keys(values, count, keys, others, min_key, max_key);
+    std::sort(others.begin(), others.end());
+
+    // distinct table indices with their counts, ascending
+    std::vector<std::pair<unsigned int, int>> key_counts;
+    if (!keys.empty() && (max_key - min_key <= 4 * count))
+    {
+        std::vector<int> counts(max_key - min_key + 1, 0);
+        for (unsigned int key : keys)
+        {
+            counts[key - min_key]++;
+        }
+        for (size_t key = 0; key < counts.size(); key++)
+        {
+            if (counts[key] > 0)
+            {
+                key_counts.push_back(std::make_pair(min_key + (unsigned int)key, counts[key]));
+            }
+        }
+    }
+    else
+    {
+        std::sort(keys.begin(), keys.end());
+        for (unsigned int key : keys)
+        {
+            if (key_counts.empty() || (key_counts.back().first != key))
+            {
+                key_counts.push_back(std::make_pair(key, 0));
+            }
+            key_counts.back().second++;
+        }
+    }
+
+    // merge the table widths with the other values
+    histogram.clear();
+    auto add_other = [&](const float value) {
+        if (histogram.empty() || (histogram.back().first != value))
+        {
+            histogram.push_back(std::make_pair(value, 0));
+        }
+        histogram.back().second++;
+    };
+    size_t other = 0;
+    for (const std::pair<unsigned int, int> &key_count : key_counts)
+    {
+        for (; (other < others.size()) && (others[other] < table[key_count.first]); other++)
+        {
+            add_other(others[other]);
+        }
+        histogram.push_back(std::make_pair(table[key_count.first], key_count.second));
+    }
+    for (; other < others.size(); other++)
+    {
+        add_other(others[other]);
+    }
+}
+
+//===============================================================================
+// median()
+//-------------------------------------------------------------------------------
+// Median of stroke widths given as a histogram, the same value as median() of
+// the widths themselves.
+//
+// parameters:
+//  - histogram: distinct stroke widths, ascending, with their counts
+//  - count: sum of the counts, at least 1
+// return: the median
+//===============================================================================
+float helper::median(const std::vector<std::pair<float, int>> &histogram, const size_t count)
+{
+    // value at a sorted position
+    auto value_at = [&](size_t position) {
+        for (const std::pair<float, int> &bin : histogram)
+        {
+            if (position < (size_t)bin.second)
+            {
+                return bin.first;
+            }
+            position -= bin.second;
+        }
+        return histogram.back().first;
+    };
+
+    const size_t half = count / 2;
+    if (count % 2 == 0)
+    {
+        return (value_at(half) + value_at(half - 1)) / 2;
+    }
+    return value_at(half);
+}
+
+// integral image with sums of type Sum, see compute_masked_color_integral()
+template <typename Sum>
+static void masked_color_integral(const cv::Mat &input_image, const cv::Mat &labels, const cv::Rect2i &region,
+                                  cv::Mat &integral)
+{
+    typedef cv::Vec<Sum, 4> Sums;
+    for (int i = 0; i < region.height; i++)
+    {
+        const cv::Vec3b *color_row = input_image.ptr<cv::Vec3b>(region.y + i) + region.x;
+        const Sums *above = integral.ptr<Sums>(i);
+        Sums *current = integral.ptr<Sums>(i + 1);
+        Sums row_sum;
+        for (int j = 0; j < region.width; j++)
+        {
+            bool labeled = (labels.type() == CV_16UC1) ? (labels.at<unsigned short>(region.y + i, region.x + j) > 0)
+                                                       : (labels.at<int>(region.y + i, region.x + j) > 0);
+            if (labeled)
+                row_sum += Sums(color_row[j][0], color_row[j][1], color_row[j][2], 1);
+            current[j + 1] = above[j + 1] + row_sum;
+        }
+    }
+}
+
+// sums of the labeled pixels inside a box, see masked_mean()
+template <typename Sum>
+static cv::Vec4d masked_sums(const cv::Mat &integral, const int top, const int left, const cv::Rect2i &box)
+{
+    typedef cv::Vec<Sum, 4> Sums;
+    const Sums sums = integral.at<Sums>(top + box.height, left + box.width) - integral.at<Sums>(top, left + box.width) -
+                      integral.at<Sums>(top + box.height, left) + integral.at<Sums>(top, left);
+    return cv::Vec4d(sums[0], sums[1], sums[2], sums[3]);
+}
+
+//===============================================================================
+// compute_masked_color_integral()
+//-------------------------------------------------------------------------------
+// Integral image of the colors of the labeled pixels and of their count, over a
+// region of the input image, in one pass. With it masked_mean() gets the mean
+// color of the labeled pixels in any box inside the region in constant time.
+// The sums are integers, stored in ints if 255 times the region area fits,
+// otherwise in doubles, so they are exact.
+//
+// parameters:
+//  - input_image: [CV_8UC3] matrix with the input image
+//  - labels: [CV_16UC1 or CV_32SC1] matrix with labels, pixels with a label > 0 are counted
+//  - region: part of the image to integrate
+//  - integral: [CV_32SC4 or CV_64FC4] output matrix of size region + 1, the color sums and
+//              the pixel count of the rows and columns above and left of each position
+// return: void
+//===============================================================================
+void helper::compute_masked_color_integral(const cv::Mat &input_image, const cv::Mat &labels,
+                                           const cv::Rect2i &region, cv::Mat &integral)
+{
+    CV_Assert((input_image.type() == CV_8UC3) && ((labels.type() == CV_16UC1) || (labels.type() == CV_32SC1)));
+    if ((long long)region.area() * 255 <= INT_MAX)
+    {
+        integral = cv::Mat::zeros(region.height + 1, region.width + 1, CV_32SC4);
+        masked_color_integral<int>(input_image, labels, region, integral);
+    }
+    else
+    {
+        integral = cv::Mat::zeros(region.height + 1, region.width + 1, CV_64FC4);
+        masked_color_integral<double>(input_image, labels, region, integral);
     }
-    return groups;
+}
+
+//===============================================================================
+// masked_mean()
+//-------------------------------------------------------------------------------
+// Mean color of the labeled pixels inside a box, the same value as cv::mean
+// with the label mask: the sums times the inverse count.
+//
+// parameters:
+//  - integral: output of compute_masked_color_integral()
+//  - region: the region the integral was built for
+//  - box: box inside the region
+// return: the mean color, 0 if the box holds no labeled pixel
+//===============================================================================
+cv::Scalar helper::masked_mean(const cv::Mat &integral, const cv::Rect2i &region, const cv::Rect2i &box)
+{
+    const int top = box.y - region.y;
+    const int left = box.x - region.x;
+    const cv::Vec4d sums = (integral.type() == CV_32SC4) ? masked_sums<int>(integral, top, left, box)
+                                                         : masked_sums<double>(integral, top, left, box);
+    if (sums[3] == 0)
+        return cv::Scalar::all(0);
+    return cv::Scalar(sums[0], sums[1], sums[2]) * (1. / sums[3]);
 }
 
 //===============================================================================
@@ -88,7 +479,7 @@ std::vector<std::vector<int>> helper::connected_letters(int n, std::vector<std::
 // parameters:
 //  - input_image: [CV_32FC1] matrix with the input image
 //  - swt_image: [CV_32FC1] matrix with the stroke widths
-//  - text_labels: [CV_16UC1] matrix with labels of recognized text components
+//  - text_labels: [CV_16UC1 or CV_32SC1] matrix with labels of recognized text components
 //  - text_components: vector of vector of points with text components
 //  - bounding_boxes: vector of bounding boxes of all text components
 //  - height_ratio_threshold: ratio of the vertical distance between two bounding boxes
@@ -108,126 +499,253 @@ void helper::find_letter_groups(const cv::Mat &input_image, const cv::Mat &swt_i
                                 std::vector<cv::Rect2i> &group_bounding_boxes,
                                 std::vector<cv::Rect2i> &letter_bounding_boxes)
 {
-    cv::Mat mask = cv::Mat::zeros(input_image.size(), CV_8U);
-    cv::threshold(text_labels, mask, 0, 255, cv::THRESH_BINARY);
-    mask.convertTo(mask, CV_8U);
-
-    std::vector<std::vector<int>> combinations;
-    for (int comp_i = 0; comp_i < text_components.size(); comp_i++)
+    algorithms::RunComponents text_run_components;
+    algorithms::encode_runs(text_components, text_run_components);
+    std::vector<algorithms::ComponentStats> text_stats;
+    algorithms::compute_component_stats(swt_image, input_image, text_run_components, text_stats);
+    for (size_t i = 0; i < text_stats.size(); i++)
     {
-        int offset = comp_i + 1;
-        for (int comp_j = offset; comp_j < text_components.size(); comp_j++)
-        {
-            cv::Rect2i box1 = bounding_boxes.at(comp_i);
-            cv::Rect2i box2 = bounding_boxes.at(comp_j);
+        text_stats[i].bounding_box = bounding_boxes[i];
+    }
 
-            // check height ratio between bounding boxes
-            // paper: 1/2 < ratio < 2
-            float height_ratio = box1.height / (float)box2.height;
-            if (height_ratio > height_ratio_threshold || height_ratio < 1 / height_ratio_threshold)
-                continue;
+    find_letter_groups(input_image, text_labels, text_run_components, text_stats, height_ratio_threshold,
+                       width_ratio_threshold, median_ratio_threshold, distance_ratio, color_distance_threshold,
+                       group_bounding_boxes, letter_bounding_boxes);
+}
 
-            // check width ratio between bounding boxes
-            // paper: no threshold
-            float width_ratio = box1.width / (float)box2.width;
-            if (width_ratio > width_ratio_threshold || width_ratio < 1 / width_ratio_threshold)
-                continue;
+//===============================================================================
+// find_letter_groups()
+//-------------------------------------------------------------------------------
+// Same as above on the runs and the features of the text components. The median
+// and the mean color of every component are computed once, in parallel, before
+// any pair is checked. The mean color is taken inside the bounding box over all
+// text pixels, like before. If no other text box overlaps the box, those are
+// the component's own pixels and the color sum gives the mean without a pixel
+// pass. Otherwise it comes from an integral image of the text pixel colors over
+// the cluster of overlapping boxes it belongs to, built and dropped by the thread
+// that takes the cluster.
+// Overlaps and candidate pairs come from a sweep over the boxes sorted by their
+// top edge, instead of checking all pairs. The pairs are checked in parallel
+// and sorted into the order of the serial loop before the letters are grouped,
+// so the groups do not depend on the number of threads. The box of a group is
+// the union of the boxes of its letters, the pixels of a group are only merged
+// if group_components is given.
+//
+// parameters:
+//  - text_components: the runs of the text components
+//  - text_stats: features of the text components, the bounding boxes included
+//  - group_components: optional output with the runs of every group, in raster order
+//  - see find_letter_groups() above for the others
+// return: void
+//===============================================================================
+void helper::find_letter_groups(const cv::Mat &input_image, const cv::Mat &text_labels,
+                                const algorithms::RunComponents &text_components,
+                                const std::vector<algorithms::ComponentStats> &text_stats,
+                                const float height_ratio_threshold, const float width_ratio_threshold,
+                                const float median_ratio_threshold, const float distance_ratio,
+                                const float color_distance_threshold, std::vector<cv::Rect2i> &group_bounding_boxes,
+                                std::vector<cv::Rect2i> &letter_bounding_boxes,
+                                algorithms::RunComponents *group_components)
+{
+    // components sorted by the top edge of their box
+    std::vector<int> order(text_stats.size());
+    for (size_t comp_i = 0; comp_i < order.size(); comp_i++)
+        order[comp_i] = (int)comp_i;
+    std::sort(order.begin(), order.end(), [&](const int a, const int b) {
+        return (text_stats[a].bounding_box.y < text_stats[b].bounding_box.y) ||
+               ((text_stats[a].bounding_box.y == text_stats[b].bounding_box.y) && (a < b));
+    });
 
-            // check if bounding boxes are on the same line
-            int pos1 = box1.y + box1.height / 2.f;
-            int pos2 = box2.y + box2.height / 2.f;
-            if (pos1 < box2.y || pos2 < box1.y)
+    // boxes overlapped by another text box, found with a sweep over the top edges
+    std::vector<unsigned char> overlapped(text_stats.size(), input_image.type() != CV_8UC3);
+    bool any_overlapped = (input_image.type() != CV_8UC3) && !text_stats.empty();
+    std::vector<std::pair<int, int>> overlapping_pairs;
+    for (size_t first = 0; first < order.size(); first++)
+    {
+        const cv::Rect2i &box = text_stats[order[first]].bounding_box;
+        for (size_t second = first + 1;
+             (second < order.size()) && (text_stats[order[second]].bounding_box.y < box.y + box.height); second++)
+        {
+            if ((box & text_stats[order[second]].bounding_box).area() == 0)
                 continue;
+            overlapped[order[first]] = overlapped[order[second]] = 1;
+            any_overlapped = true;
+            overlapping_pairs.push_back(std::make_pair(order[first], order[second]));
+        }
+    }
 
-            // check the distance between the bounding boxes
-            // paper: 3 * max_width
-            float max_width = std::max(box1.width, box2.width);
-            int distance;
-            if (box1.x < box2.x)
-                distance = std::abs(box1.x + box1.width - box2.x);
-            else
-                distance = std::abs(box2.x + box2.width - box1.x);
+    // the overlapped boxes get their mean color from an integral image over
+    // their cluster of overlapping boxes, other inputs from cv::mean
+    const bool use_integral = any_overlapped && (input_image.type() == CV_8UC3);
+    LetterGroups overlap_clusters;
+    cv::Mat mask;
+    if (use_integral)
+        helper::connected_letters((int)text_stats.size(), overlapping_pairs, overlap_clusters);
+    else if (any_overlapped)
+        mask = (text_labels > 0);
 
-            if (distance > distance_ratio * max_width)
+    // median and mean color of every component, once before the pairs are checked
+    std::vector<float> medians(text_stats.size());
+    std::vector<cv::Scalar> average_colors(text_stats.size());
+    cv::parallel_for_(cv::Range(0, (int)text_stats.size()), [&](const cv::Range &range) {
+        for (int comp_i = range.start; comp_i < range.end; comp_i++)
+        {
+            const algorithms::ComponentStats &stats = text_stats[comp_i];
+            medians[comp_i] = helper::median(stats.width_histogram, stats.pixel_count);
+            if (overlapped[comp_i] && use_integral)
                 continue;
-
-            // compare median stroke width
-            std::vector<float> stroke_widths_comp1;
-            for (const cv::Point2i &p : text_components.at(comp_i))
+            if (overlapped[comp_i])
             {
-                float stroke_width = swt_image.at<float>(p);
-                stroke_widths_comp1.push_back(stroke_width);
+                average_colors[comp_i] = cv::mean(input_image(stats.bounding_box), mask(stats.bounding_box));
+                continue;
             }
-            float median1 = 0.0f;
-            std::sort(stroke_widths_comp1.begin(), stroke_widths_comp1.end());
-            int vector_length1 = stroke_widths_comp1.size();
-            if (vector_length1 % 2)
-                median1 = stroke_widths_comp1.at(vector_length1 / 2);
-            else
-                median1 = 0.5f *
-                          (stroke_widths_comp1.at(vector_length1 / 2) + stroke_widths_comp1.at(vector_length1 / 2 - 1));
-
-            std::vector<float> stroke_widths_comp2;
-            for (const cv::Point2i &p : text_components.at(comp_j))
+            // same as cv::mean: sum times the inverse count
+            average_colors[comp_i] = cv::Scalar(stats.color_sum[0], stats.color_sum[1], stats.color_sum[2]) *
+                                     (1. / stats.pixel_count);
+        }
+    });
+    if (use_integral)
+    {
+        cv::parallel_for_(cv::Range(0, (int)overlap_clusters.size()), [&](const cv::Range &range) {
+            cv::Mat integral;
+            for (int cluster = range.start; cluster < range.end; cluster++)
             {
-                float stroke_width = swt_image.at<float>(p);
-                stroke_widths_comp2.push_back(stroke_width);
+                if (overlap_clusters.end(cluster) - overlap_clusters.begin(cluster) < 2)
+                    continue;
+                cv::Rect2i region = text_stats[*overlap_clusters.begin(cluster)].bounding_box;
+                for (const int *comp_i = overlap_clusters.begin(cluster); comp_i != overlap_clusters.end(cluster);
+                     comp_i++)
+                    region |= text_stats[*comp_i].bounding_box;
+                helper::compute_masked_color_integral(input_image, text_labels, region, integral);
+                for (const int *comp_i = overlap_clusters.begin(cluster); comp_i != overlap_clusters.end(cluster);
+                     comp_i++)
+                    average_colors[*comp_i] = helper::masked_mean(integral, region, text_stats[*comp_i].bounding_box);
             }
-            float median2 = 0.0f;
-            std::sort(stroke_widths_comp2.begin(), stroke_widths_comp2.end());
-            int vector_length2 = stroke_widths_comp2.size();
-            if (vector_length2 % 2)
-                median2 = stroke_widths_comp2.at(vector_length2 / 2);
-            else
-                median2 = 0.5f *
-                          (stroke_widths_comp2.at(vector_length2 / 2) + stroke_widths_comp2.at(vector_length2 / 2 - 1));
-
-            // check the ratio of the median stroke widths
-            // paper: 1/2 < ratio < 2.0
-            if (median1 / median2 > median_ratio_threshold || median2 / median1 > median_ratio_threshold)
-                continue;
+        });
+    }
 
-            // compare average color distance
-            // paper: color_distance < 40
-            cv::Mat mask_roi1 = mask(box1);
-            cv::Mat mask_roi2 = mask(box2);
+    // all checks of a pair of components, comp_i < comp_j
+    auto belong_together = [&](const int comp_i, const int comp_j) -> bool {
+        cv::Rect2i box1 = text_stats.at(comp_i).bounding_box;
+        cv::Rect2i box2 = text_stats.at(comp_j).bounding_box;
 
-            cv::Mat roi1 = input_image(box1);
-            cv::Mat roi2 = input_image(box2);
+        // check height ratio between bounding boxes
+        // paper: 1/2 < ratio < 2
+        float height_ratio = box1.height / (float)box2.height;
+        if (height_ratio > height_ratio_threshold || height_ratio < 1 / height_ratio_threshold)
+            return false;
 
-            cv::Scalar average_color1 = cv::mean(roi1, mask_roi1);
-            cv::Scalar average_color2 = cv::mean(roi2, mask_roi2);
+        // check width ratio between bounding boxes
+        // paper: no threshold
+        float width_ratio = box1.width / (float)box2.width;
+        if (width_ratio > width_ratio_threshold || width_ratio < 1 / width_ratio_threshold)
+            return false;
 
-            float color_distance = std::sqrt(std::pow(average_color1[0] - average_color2[0], 2) +
-                                             std::pow(average_color1[1] - average_color2[1], 2) +
-                                             std::pow(average_color1[2] - average_color2[2], 2));
+        // check if bounding boxes are on the same line
+        int pos1 = box1.y + box1.height / 2.f;
+        int pos2 = box2.y + box2.height / 2.f;
+        if (pos1 < box2.y || pos2 < box1.y)
+            return false;
 
-            if (color_distance > color_distance_threshold)
-                continue;
+        // check the distance between the bounding boxes
+        // paper: 3 * max_width
+        float max_width = std::max(box1.width, box2.width);
+        int distance;
+        if (box1.x < box2.x)
+            distance = std::abs(box1.x + box1.width - box2.x);
+        else
+            distance = std::abs(box2.x + box2.width - box1.x);
+
+        if (distance > distance_ratio * max_width)
+            return false;
+
+        // compare median stroke width
+        float median1 = medians[comp_i];
+        float median2 = medians[comp_j];
+
+        // check the ratio of the median stroke widths
+        // paper: 1/2 < ratio < 2.0
+        if (median1 / median2 > median_ratio_threshold || median2 / median1 > median_ratio_threshold)
+            return false;
 
-            combinations.push_back({comp_i, comp_j});
+        // compare average color distance
+        // paper: color_distance < 40
+        const cv::Scalar &average_color1 = average_colors[comp_i];
+        const cv::Scalar &average_color2 = average_colors[comp_j];
+
+        float color_distance = std::sqrt(std::pow(average_color1[0] - average_color2[0], 2) +
+                                         std::pow(average_color1[1] - average_color2[1], 2) +
+                                         std::pow(average_color1[2] - average_color2[2], 2));
+
+        if (color_distance > color_distance_threshold)
+            return false;
+
+        return true;
+    };
+
+    // candidate pairs from the same sweep: two boxes can only be on the same
+    // line if the lower top edge is not below the middle of the other box.
+    // Stripes of the sorted boxes are checked in parallel, a few per thread
+    const int num_stripes = std::max(1, std::min((int)order.size(), cv::getNumThreads() * 4));
+    std::vector<std::vector<std::pair<int, int>>> stripe_combinations(num_stripes);
+    cv::parallel_for_(cv::Range(0, num_stripes), [&](const cv::Range &range) {
+        for (int stripe = range.start; stripe < range.end; stripe++)
+        {
+            size_t stripe_end = order.size() * (stripe + 1) / num_stripes;
+            for (size_t first = order.size() * stripe / num_stripes; first < stripe_end; first++)
+            {
+                const cv::Rect2i &box = text_stats[order[first]].bounding_box;
+                int middle = box.y + box.height / 2.f;
+                for (size_t second = first + 1;
+                     (second < order.size()) && (text_stats[order[second]].bounding_box.y <= middle); second++)
+                {
+                    int comp_i = std::min(order[first], order[second]);
+                    int comp_j = std::max(order[first], order[second]);
+                    if (belong_together(comp_i, comp_j))
+                        stripe_combinations[stripe].push_back(std::make_pair(comp_i, comp_j));
+                }
+            }
         }
-    }
+    }, num_stripes);
+
+    // same order as checking every pair, the groups depend on it
+    std::vector<std::pair<int, int>> combinations;
+    for (const std::vector<std::pair<int, int>> &pairs : stripe_combinations)
+        combinations.insert(combinations.end(), pairs.begin(), pairs.end());
+    std::sort(combinations.begin(), combinations.end());
 
     // merge letters to create groups
     // use helper function to find connected components
-    std::vector<std::vector<int>> letter_groups = helper::connected_letters(text_components.size(), combinations);
-    std::vector<std::vector<cv::Point2i>> group_components;
+    LetterGroups letter_groups;
+    helper::connected_letters((int)text_components.size(), combinations, letter_groups);
+    std::vector<algorithms::Run> group_runs;
 
-    for (std::vector<int> &letter_group : letter_groups)
+    for (size_t group = 0; group < letter_groups.size(); group++)
     {
         // include only groups with multiple letters (more than 1)
-        if (letter_group.size() <= 1)
+        if (letter_groups.end(group) - letter_groups.begin(group) <= 1)
             continue;
 
-        std::vector<cv::Point2i> group_component;
-        for (int &letter_index : letter_group)
+        cv::Rect2i group_box;
+        group_runs.clear();
+        for (const int *letter = letter_groups.begin(group); letter != letter_groups.end(group); letter++)
+        {
+            const int letter_index = *letter;
+            const cv::Rect2i &letter_box = text_stats.at(letter_index).bounding_box;
+            letter_bounding_boxes.push_back(letter_box);
+            group_box = group_box.empty() ? letter_box : (group_box | letter_box);
+            if (group_components != nullptr)
+                group_runs.insert(group_runs.end(), text_components.begin(letter_index),
+                                  text_components.end(letter_index));
+        }
+        group_bounding_boxes.push_back(group_box);
+
+        if (group_components != nullptr)
         {
-            letter_bounding_boxes.push_back(bounding_boxes.at(letter_index));
-            std::vector<cv::Point2i> component = text_components.at(letter_index);
-            group_component.insert(group_component.begin(), component.begin(), component.end());
+            std::sort(group_runs.begin(), group_runs.end(), [](const algorithms::Run &a, const algorithms::Run &b) {
+                return (a.row < b.row) || ((a.row == b.row) && (a.col_begin < b.col_begin));
+            });
+            group_components->push_back(group_runs.data(), group_runs.data() + group_runs.size());
         }
-        group_components.push_back(group_component);
     }
-    algorithms::compute_bounding_boxes(group_components, group_bounding_boxes);
 }
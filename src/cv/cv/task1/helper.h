@@ -1,11 +1,32 @@
 #ifndef CGCV_HELPER_H
 #define CGCV_HELPER_H
 
+#include "algorithms.h"
 #include "opencv2/opencv.hpp"
 
 class helper
 {
    public:
+    // letter groups in one array: the letters of the group at index g are
+    // members[first[g]] to members[first[g + 1] - 1]
+    struct LetterGroups
+    {
+        std::vector<int> first = std::vector<int>(1, 0);
+        std::vector<int> members;
+
+        size_t size() const { return first.size() - 1; }
+        const int *begin(size_t group) const { return members.data() + first[group]; }
+        const int *end(size_t group) const { return members.data() + first[group + 1]; }
+    };
+
+    static float median(float *values, size_t count);
+    static float median(const std::vector<std::pair<float, int>> &histogram, size_t count);
+    static void stroke_width_histogram(const float *values, size_t count,
+                                       std::vector<std::pair<float, int>> &histogram);
+    static void compute_masked_color_integral(const cv::Mat &input_image, const cv::Mat &labels,
+                                              const cv::Rect2i &region, cv::Mat &integral);
+    static cv::Scalar masked_mean(const cv::Mat &integral, const cv::Rect2i &region, const cv::Rect2i &box);
+    static void connected_letters(const int n, const std::vector<std::pair<int, int>> &edges, LetterGroups &groups);
     static std::vector<std::vector<int>> connected_letters(int n, std::vector<std::vector<int>>& edges);
     static void find_letter_groups(const cv::Mat &input_image, const cv::Mat &swt_image, const cv::Mat &text_labels,
                                    const std::vector<std::vector<cv::Point2i>> &text_components,
@@ -14,6 +35,14 @@ class helper
                                    const float distance_ratio, const float color_distance_threshold,
                                    std::vector<cv::Rect2i> &group_bounding_boxes,
                                    std::vector<cv::Rect2i> &letter_bounding_boxes);
+    static void find_letter_groups(const cv::Mat &input_image, const cv::Mat &text_labels,
+                                   const algorithms::RunComponents &text_components,
+                                   const std::vector<algorithms::ComponentStats> &text_stats,
+                                   const float height_ratio_threshold, const float width_ratio_threshold,
+                                   const float median_ratio_threshold, const float distance_ratio,
+                                   const float color_distance_threshold, std::vector<cv::Rect2i> &group_bounding_boxes,
+                                   std::vector<cv::Rect2i> &letter_bounding_boxes,
+                                   algorithms::RunComponents *group_components = nullptr);
 };
 
 #endif  // CGCV_HELPER_H
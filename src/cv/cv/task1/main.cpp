@@ -55,6 +55,21 @@ struct Config
     float distance_ratio = 0.f;
     float median_ratio_threshold = 0.f;
     float color_distance_threshold = 0.f;
+
+    // swt limits (optional, 0 = unlimited, max_ray_length defaults to max_height)
+    int max_ray_length = 0;
+    long long max_rays = 0;
+    long long max_ray_steps = 0;
+
+    // parallelism (optional, 0 = OpenCV default)
+    int num_threads = 0;
+
+    // dual polarity (optional): also find the text of the opposite polarity from the same edge scan
+    bool dual_polarity = false;
+
+    // benchmark (optional, 0 = off)
+    int benchmark_threads = 0;
+    int benchmark_ccl_megapixels = 0;
 };
 
 //===============================================================================
@@ -137,14 +152,16 @@ std::vector<cv::Vec3b> build_colormap()
 //  - Nothing!
 //  - Do not change anything here
 //===============================================================================
-cv::Mat create_ray_image(const std::vector<std::vector<cv::Point2i>> &rays, cv::Size image_dims)
+cv::Mat create_ray_image(const algorithms::RayList &rays, cv::Size image_dims)
 {
     // display rays
     cv::Mat ray_image = cv::Mat::zeros(image_dims, CV_8UC3);
 
-    for (const std::vector<cv::Point2i>& ray : rays)
+    std::vector<cv::Point2i> ray_pixels;
+    for (const algorithms::Ray& ray : rays)
     {
-        for (const cv::Point2i& point : ray)
+        algorithms::swt_ray_pixels(ray, ray_pixels);
+        for (const cv::Point2i& point : ray_pixels)
         {
             ray_image.at<cv::Vec3b>(point) = cv::Vec3b{255, 0, 0};
         }
@@ -152,6 +169,52 @@ cv::Mat create_ray_image(const std::vector<std::vector<cv::Point2i>> &rays, cv::
     return ray_image;
 }
 
+//===============================================================================
+// swt_limits()
+//-------------------------------------------------------------------------------
+// Collects the ray length limit and the per image budgets of the SWT.
+//===============================================================================
+algorithms::SwtLimits swt_limits(const Config& config)
+{
+    algorithms::SwtLimits limits;
+    limits.max_ray_length = config.max_ray_length;
+    limits.max_rays = config.max_rays;
+    limits.max_ray_steps = config.max_ray_steps;
+    return limits;
+}
+
+//===============================================================================
+// find_text_groups()
+//-------------------------------------------------------------------------------
+// Steps 4 to 8 of run() on stroke widths that are already estimated, without
+// the intermediate images. Used for the opposite polarity of a dual polarity run.
+//===============================================================================
+void find_text_groups(const cv::Mat& input_image, const cv::Mat& swt_stroke_width_image,
+                      const algorithms::RayList& rays, const Config& config, std::vector<cv::Rect2i>& group_bounding_boxes,
+                      std::vector<cv::Rect2i>& letter_bounding_boxes)
+{
+    cv::Mat swt_final_image = cv::Mat(swt_stroke_width_image.size(), CV_32FC1, cv::Scalar(FLT_MAX));
+    algorithms::swt_postprocessing(swt_stroke_width_image, rays, swt_final_image);
+
+    cv::Mat labels = cv::Mat::zeros(swt_final_image.size(), CV_16UC1);
+    algorithms::RunComponents components;
+    std::vector<algorithms::ComponentStats> component_stats;
+    algorithms::get_connected_components(swt_final_image, input_image, config.stroke_width_ratio_threshold,
+                                         config.neighbor_offset, labels, components, component_stats);
+
+    algorithms::RunComponents text_components;
+    cv::Mat text_labels = cv::Mat::zeros(swt_final_image.size(), labels.type());
+    std::vector<cv::Rect2i> text_bounding_boxes;
+    std::vector<algorithms::ComponentStats> text_stats;
+    algorithms::discard_non_text(swt_final_image, component_stats, components, labels, config.variance_ratio,
+                                 config.aspect_ratio_threshold, config.diameter_ratio_threshold, config.min_height, config.max_height,
+                                 text_bounding_boxes, text_components, text_labels, text_stats);
+
+    helper::find_letter_groups(input_image, text_labels, text_components, text_stats, config.height_ratio_threshold,
+                               config.width_ratio_threshold, config.median_ratio_threshold, config.distance_ratio,
+                               config.color_distance_threshold, group_bounding_boxes, letter_bounding_boxes);
+}
+
 //===============================================================================
 // run()
 //-------------------------------------------------------------------------------
@@ -211,9 +274,25 @@ void run(const cv::Mat& input_image, const std::string& out_directory, const std
     //=============================================================================
     std::cout << "Step 4 - calculating swt image... " << std::endl;
     cv::Mat swt_stroke_width_image = cv::Mat::zeros(input_image.size(), CV_32FC1);
-    std::vector<std::vector<cv::Point2i>> rays;
-    algorithms::swt_compute_stroke_width(canny_edges, direction_x, direction_y, config.black_on_white, rays,
-                                         swt_stroke_width_image);
+    algorithms::RayList rays;
+    // the opposite polarity of a dual polarity run, cast in the same edge scan
+    cv::Mat opposite_stroke_width_image;
+    algorithms::RayList opposite_rays;
+    if (config.dual_polarity)
+    {
+        opposite_stroke_width_image = cv::Mat::zeros(input_image.size(), CV_32FC1);
+        if (config.black_on_white)
+            algorithms::swt_compute_stroke_width_dual(canny_edges, direction_x, direction_y, swt_limits(config),
+                                                      rays, swt_stroke_width_image, opposite_rays,
+                                                      opposite_stroke_width_image);
+        else
+            algorithms::swt_compute_stroke_width_dual(canny_edges, direction_x, direction_y, swt_limits(config),
+                                                      opposite_rays, opposite_stroke_width_image, rays,
+                                                      swt_stroke_width_image);
+    }
+    else
+        algorithms::swt_compute_stroke_width(canny_edges, direction_x, direction_y, config.black_on_white,
+                                             swt_limits(config), rays, swt_stroke_width_image);
 
     cv::Mat ray_image = create_ray_image(rays, input_image.size());
     save_image(out_directory, "swt_rays", ++image_counter, ray_image);
@@ -231,9 +310,10 @@ void run(const cv::Mat& input_image, const std::string& out_directory, const std
     //=============================================================================
     std::cout << "Step 5 - calculating connected components... " << std::endl;
     cv::Mat labels = cv::Mat::zeros(swt_final_image.size(), CV_16UC1);
-    std::vector<std::vector<cv::Point2i>> components;
-    algorithms::get_connected_components(swt_final_image, config.stroke_width_ratio_threshold, config.neighbor_offset, labels,
-                                         components);
+    algorithms::RunComponents components;
+    std::vector<algorithms::ComponentStats> component_stats;
+    algorithms::get_connected_components(swt_final_image, input_image, config.stroke_width_ratio_threshold,
+                                         config.neighbor_offset, labels, components, component_stats);
 
     // normalize labels
     double min_label, max_label;
@@ -251,7 +331,7 @@ void run(const cv::Mat& input_image, const std::string& out_directory, const std
     //=============================================================================
     std::cout << "Step 6 - calculating bounding boxes... " << std::endl;
     std::vector<cv::Rect2i> bounding_boxes;
-    algorithms::compute_bounding_boxes(components, bounding_boxes);
+    algorithms::compute_bounding_boxes(component_stats, bounding_boxes);
 
     // display bounding boxes
     cv::Mat display_bounding_boxes;
@@ -265,12 +345,18 @@ void run(const cv::Mat& input_image, const std::string& out_directory, const std
     // Discard non-text
     //=============================================================================
     std::cout << "Step 7 - discard non-text... " << std::endl;
-    std::vector<std::vector<cv::Point2i>> text_components;
-    cv::Mat text_labels = cv::Mat::zeros(swt_final_image.size(), CV_16UC1);
+    algorithms::RunComponents text_components;
+    cv::Mat text_labels = cv::Mat::zeros(swt_final_image.size(), labels.type());
     std::vector<cv::Rect2i> text_bounding_boxes;
-    algorithms::discard_non_text(swt_final_image, bounding_boxes, components, labels, config.variance_ratio,
+    std::vector<algorithms::ComponentStats> text_stats;
+    algorithms::DiscardCounts discard_counts;
+    algorithms::discard_non_text(swt_final_image, component_stats, components, labels, config.variance_ratio,
                                  config.aspect_ratio_threshold, config.diameter_ratio_threshold, config.min_height, config.max_height,
-                                 text_bounding_boxes, text_components, text_labels);
+                                 text_bounding_boxes, text_components, text_labels, text_stats, &discard_counts);
+    std::cout << "  kept " << discard_counts.kept << " of " << component_stats.size()
+              << " components, removed as empty " << discard_counts.empty << ", by aspect ratio "
+              << discard_counts.aspect_ratio << ", height " << discard_counts.height << ", diameter ratio "
+              << discard_counts.diameter_ratio << ", variance ratio " << discard_counts.variance_ratio << std::endl;
 
     // normalize labels with max_label and min_label to generate same color coding
     cv::Mat display_text_labels = cv::Mat::zeros(input_image.size(), CV_8UC1);
@@ -296,10 +382,9 @@ void run(const cv::Mat& input_image, const std::string& out_directory, const std
     std::cout << "Step 8 - find letter groups... " << std::endl;
     std::vector<cv::Rect2i> group_bounding_boxes;
     std::vector<cv::Rect2i> letter_bounding_boxes;
-    helper::find_letter_groups(input_image, swt_final_image, text_labels, text_components, text_bounding_boxes,
-                               config.height_ratio_threshold, config.width_ratio_threshold, config.median_ratio_threshold,
-                               config.distance_ratio, config.color_distance_threshold, group_bounding_boxes,
-                               letter_bounding_boxes);
+    helper::find_letter_groups(input_image, text_labels, text_components, text_stats, config.height_ratio_threshold,
+                               config.width_ratio_threshold, config.median_ratio_threshold, config.distance_ratio,
+                               config.color_distance_threshold, group_bounding_boxes, letter_bounding_boxes);
     // display bounding boxes
     cv::Mat display_group_bounding_boxes;
     display_text_labels.copyTo(display_group_bounding_boxes);
@@ -359,8 +444,260 @@ void run(const cv::Mat& input_image, const std::string& out_directory, const std
     cv::Mat edges = cv::Mat::zeros(input_image.size(), CV_8UC1);
     algorithms::canny_own(grayscale, config.edge_threshold_min, config.edge_threshold_max, edges);
     save_image(out_directory + "bonus/", "bonus_edges", ++image_counter, edges);
+
+    //=============================================================================
+    // Opposite polarity of a dual polarity run
+    //=============================================================================
+    if (config.dual_polarity)
+    {
+        std::cout << "Dual polarity - find letter groups of the opposite polarity... " << std::endl;
+        std::vector<cv::Rect2i> opposite_group_bounding_boxes;
+        std::vector<cv::Rect2i> opposite_letter_bounding_boxes;
+        find_text_groups(input_image, opposite_stroke_width_image, opposite_rays, config,
+                         opposite_group_bounding_boxes, opposite_letter_bounding_boxes);
+
+        // both polarities, the opposite one in yellow and magenta
+        cv::Mat dual_final_image;
+        final_image.copyTo(dual_final_image);
+        for (cv::Rect2i & group_bounding_box : opposite_group_bounding_boxes)
+        {
+            cv::rectangle(dual_final_image, group_bounding_box, cv::Scalar(0, 255, 255));
+        }
+        for (cv::Rect2i & letter_bounding_box : opposite_letter_bounding_boxes)
+        {
+            cv::rectangle(dual_final_image, letter_bounding_box, cv::Scalar(255, 0, 255));
+        }
+        save_image(out_directory, "final_dual_polarity", ++image_counter, dual_final_image);
+    }
+}
+
+
+//===============================================================================
+// benchmark_connected_components()
+//-------------------------------------------------------------------------------
+// Times get_connected_components with one thread and with all threads against
+// the flood fill reference on one stroke width image and checks that labels
+// and components are the same.
+//===============================================================================
+void benchmark_connected_components(const cv::Mat& swt_image, const Config& config, const std::string& name)
+{
+    const int repetitions = 3;
+    const int default_threads = cv::getNumThreads();
+    double milliseconds[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+    cv::Mat labels[3];
+    std::vector<std::vector<cv::Point2i>> components[3];
+    for (int labeller = 0; labeller < 3; labeller++)
+    {
+        cv::setNumThreads(labeller == 1 ? 1 : default_threads);
+        labels[labeller] = cv::Mat::zeros(swt_image.size(), CV_16UC1);
+        for (int repetition = 0; repetition < repetitions; repetition++)
+        {
+            components[labeller].clear();
+            cv::TickMeter timer;
+            timer.start();
+            if (labeller == 0)
+                algorithms::get_connected_components_flood_fill(swt_image, config.stroke_width_ratio_threshold,
+                                                                config.neighbor_offset, labels[0], components[0]);
+            else
+                algorithms::get_connected_components(swt_image, config.stroke_width_ratio_threshold,
+                                                     config.neighbor_offset, labels[labeller],
+                                                     components[labeller]);
+            timer.stop();
+            milliseconds[labeller] = std::min(milliseconds[labeller], timer.getTimeMilli());
+        }
+    }
+    cv::setNumThreads(default_threads);
+
+    // the flood fill collects the points in search order, the union-find row by row
+    bool identical = (cv::countNonZero(labels[0] != labels[1]) == 0) &&
+                     (cv::countNonZero(labels[0] != labels[2]) == 0) &&
+                     (components[0].size() == components[1].size()) && (components[1] == components[2]);
+    for (size_t i = 0; identical && (i < components[0].size()); i++)
+    {
+        std::vector<cv::Point2i> flood_fill_points = components[0][i];
+        std::sort(flood_fill_points.begin(), flood_fill_points.end(),
+                  [](const cv::Point2i& a, const cv::Point2i& b) { return (a.y < b.y) || ((a.y == b.y) && (a.x < b.x)); });
+        identical = (flood_fill_points == components[1][i]);
+    }
+
+    std::cout << BOLD(FGRN("[BENCH]")) << " get_connected_components, " << name << ": " << milliseconds[2] << " ms, "
+              << milliseconds[1] << " ms with 1 thread, flood fill " << milliseconds[0] << " ms"
+              << (identical ? "" : FRED(" (MISMATCH)")) << std::endl;
 }
 
+//===============================================================================
+// run_benchmark()
+//-------------------------------------------------------------------------------
+// Times the SWT ray casting with 1 to config.benchmark_threads threads and
+// checks that every thread count reproduces the single threaded result.
+//===============================================================================
+void run_benchmark(const cv::Mat& input_image, Config config)
+{
+    const int repetitions = 5;
+    const int default_threads = cv::getNumThreads();
+
+    // same preprocessing as in run()
+    cv::Mat grayscale = cv::Mat::zeros(input_image.size(), CV_8UC1);
+    cv::Mat blurred_image;
+    cv::GaussianBlur(input_image, blurred_image, cv::Size(3, 3), 0.0);
+    algorithms::compute_grayscale(blurred_image, grayscale);
+    cv::Mat gradient_x = cv::Mat::zeros(input_image.size(), CV_32FC1);
+    cv::Mat gradient_y = cv::Mat::zeros(input_image.size(), CV_32FC1);
+    cv::Mat gradient_abs = cv::Mat::zeros(input_image.size(), CV_32FC1);
+    algorithms::compute_gradient(grayscale, gradient_x, gradient_y, gradient_abs);
+    cv::Mat direction_x = cv::Mat::zeros(input_image.size(), CV_32FC1);
+    cv::Mat direction_y = cv::Mat::zeros(input_image.size(), CV_32FC1);
+    algorithms::compute_directions(gradient_x, gradient_y, gradient_abs, direction_x, direction_y);
+    cv::Mat canny_edges = cv::Mat::zeros(input_image.size(), CV_8UC1);
+    cv::Canny(grayscale, canny_edges, config.edge_threshold_min, config.edge_threshold_max, 3);
+
+    //=============================================================================
+    // SWT thread scaling
+    //=============================================================================
+    cv::Mat reference_swt;
+    algorithms::RayList reference_rays;
+    double single_thread_ms = 0.0;
+    for (int threads = 1; threads <= config.benchmark_threads; threads++)
+    {
+        cv::setNumThreads(threads);
+        double best_ms = DBL_MAX;
+        cv::Mat swt_stroke_width_image = cv::Mat::zeros(input_image.size(), CV_32FC1);
+        algorithms::RayList rays;
+        for (int repetition = 0; repetition < repetitions; repetition++)
+        {
+            rays.clear();
+            cv::TickMeter timer;
+            timer.start();
+            algorithms::swt_compute_stroke_width(canny_edges, direction_x, direction_y, config.black_on_white,
+                                                 swt_limits(config), rays, swt_stroke_width_image);
+            timer.stop();
+            best_ms = std::min(best_ms, timer.getTimeMilli());
+        }
+
+        if (threads == 1)
+        {
+            reference_swt = swt_stroke_width_image;
+            reference_rays = rays;
+            single_thread_ms = best_ms;
+        }
+        bool identical = (cv::countNonZero(swt_stroke_width_image != reference_swt) == 0) && (rays == reference_rays);
+
+        std::cout << BOLD(FGRN("[BENCH]")) << " swt_compute_stroke_width, " << threads << " thread(s): " << best_ms
+                  << " ms, speedup " << single_thread_ms / best_ms << (identical ? "" : FRED(" (MISMATCH)"))
+                  << std::endl;
+    }
+    cv::setNumThreads(default_threads);
+
+    //=============================================================================
+    // Dual polarity in one scan against two single polarity runs
+    //=============================================================================
+    double separate_ms = DBL_MAX;
+    double dual_ms = DBL_MAX;
+    cv::Mat black_on_white_swt = cv::Mat::zeros(input_image.size(), CV_32FC1);
+    cv::Mat white_on_black_swt = cv::Mat::zeros(input_image.size(), CV_32FC1);
+    cv::Mat dual_black_on_white_swt = cv::Mat::zeros(input_image.size(), CV_32FC1);
+    cv::Mat dual_white_on_black_swt = cv::Mat::zeros(input_image.size(), CV_32FC1);
+    algorithms::RayList black_on_white_rays, white_on_black_rays, dual_black_on_white_rays, dual_white_on_black_rays;
+    for (int repetition = 0; repetition < repetitions; repetition++)
+    {
+        black_on_white_rays.clear();
+        white_on_black_rays.clear();
+        cv::TickMeter timer;
+        timer.start();
+        algorithms::swt_compute_stroke_width(canny_edges, direction_x, direction_y, true, swt_limits(config),
+                                             black_on_white_rays, black_on_white_swt);
+        algorithms::swt_compute_stroke_width(canny_edges, direction_x, direction_y, false, swt_limits(config),
+                                             white_on_black_rays, white_on_black_swt);
+        timer.stop();
+        separate_ms = std::min(separate_ms, timer.getTimeMilli());
+
+        dual_black_on_white_rays.clear();
+        dual_white_on_black_rays.clear();
+        timer.reset();
+        timer.start();
+        algorithms::swt_compute_stroke_width_dual(canny_edges, direction_x, direction_y, swt_limits(config),
+                                                  dual_black_on_white_rays, dual_black_on_white_swt,
+                                                  dual_white_on_black_rays, dual_white_on_black_swt);
+        timer.stop();
+        dual_ms = std::min(dual_ms, timer.getTimeMilli());
+    }
+    bool identical = (cv::countNonZero(black_on_white_swt != dual_black_on_white_swt) == 0) &&
+                     (cv::countNonZero(white_on_black_swt != dual_white_on_black_swt) == 0) &&
+                     (black_on_white_rays == dual_black_on_white_rays) && (white_on_black_rays == dual_white_on_black_rays);
+
+    std::cout << BOLD(FGRN("[BENCH]")) << " swt_compute_stroke_width_dual: " << dual_ms << " ms, two single runs "
+              << separate_ms << " ms" << (identical ? "" : FRED(" (MISMATCH)")) << std::endl;
+
+    //=============================================================================
+    // Connected components on the image and on synthetic strokes
+    //=============================================================================
+    cv::Mat swt_final_image = cv::Mat::zeros(input_image.size(), CV_32FC1);
+    if (config.black_on_white)
+        algorithms::swt_postprocessing(black_on_white_swt, black_on_white_rays, swt_final_image);
+    else
+        algorithms::swt_postprocessing(white_on_black_swt, white_on_black_rays, swt_final_image);
+    benchmark_connected_components(swt_final_image, config, "input image");
+
+    // larger neighborhoods, the union-find cost should grow with the offset, the flood fill with its square
+    for (int neighbor_offset = 1; neighbor_offset <= 4; neighbor_offset++)
+    {
+        Config offset_config = config;
+        offset_config.neighbor_offset = neighbor_offset;
+        benchmark_connected_components(swt_final_image, offset_config,
+                                       "input image, offset " + std::to_string(neighbor_offset));
+    }
+
+    if (config.benchmark_ccl_megapixels > 0)
+    {
+        // random strokes of a few widths, about one stroke per 1000 pixels
+        int side = (int)std::sqrt(config.benchmark_ccl_megapixels * 1e6);
+        cv::Mat synthetic_swt = cv::Mat::zeros(side, side, CV_32FC1);
+        cv::RNG rng(42);
+        for (int stroke = 0; stroke < side / 32 * side / 32; stroke++)
+        {
+            cv::Point start(rng.uniform(0, side), rng.uniform(0, side));
+            cv::Point end(start.x + rng.uniform(-20, 21), start.y + rng.uniform(-20, 21));
+            int thickness = rng.uniform(1, 6);
+            cv::line(synthetic_swt, start, end, cv::Scalar((float)std::sqrt((double)rng.uniform(1, 40))), thickness);
+        }
+        benchmark_connected_components(synthetic_swt, config,
+                                       std::to_string(config.benchmark_ccl_megapixels) + " MP synthetic");
+    }
+
+    //=============================================================================
+    // AVX2 ray marching against the scalar version
+    //=============================================================================
+    if (!algorithms::swt_vectorized())
+    {
+        std::cout << BOLD(FGRN("[BENCH]")) << " swt vectorized: not supported on this CPU" << std::endl;
+        return;
+    }
+    double marching_ms[2] = {DBL_MAX, DBL_MAX};
+    cv::Mat marching_swt[2];
+    algorithms::RayList marching_rays[2];
+    for (int vectorized = 0; vectorized < 2; vectorized++)
+    {
+        algorithms::swt_set_vectorized(vectorized == 1);
+        marching_swt[vectorized] = cv::Mat::zeros(input_image.size(), CV_32FC1);
+        for (int repetition = 0; repetition < repetitions; repetition++)
+        {
+            marching_rays[vectorized].clear();
+            cv::TickMeter timer;
+            timer.start();
+            algorithms::swt_compute_stroke_width(canny_edges, direction_x, direction_y, config.black_on_white,
+                                                 swt_limits(config), marching_rays[vectorized],
+                                                 marching_swt[vectorized]);
+            timer.stop();
+            marching_ms[vectorized] = std::min(marching_ms[vectorized], timer.getTimeMilli());
+        }
+    }
+    algorithms::swt_set_vectorized(true);
+    identical = (cv::countNonZero(marching_swt[0] != marching_swt[1]) == 0) && (marching_rays[0] == marching_rays[1]);
+
+    std::cout << BOLD(FGRN("[BENCH]")) << " swt vectorized: " << marching_ms[1] << " ms, scalar " << marching_ms[0]
+              << " ms, speedup " << marching_ms[0] / marching_ms[1] << (identical ? "" : FRED(" (MISMATCH)"))
+              << std::endl;
+}
 
 //===============================================================================
 // execute_testcase()
@@ -402,6 +739,29 @@ void execute_testcase(const rapidjson::Value &config_data)
     config.median_ratio_threshold = (float) config_data["median_ratio_threshold"].GetDouble();
     config.color_distance_threshold = (float) config_data["color_distance_threshold"].GetDouble();
 
+    // swt limits
+    config.max_ray_length = config.max_height;
+    if (config_data.HasMember("max_ray_length"))
+        config.max_ray_length = (int) config_data["max_ray_length"].GetUint();
+    if (config_data.HasMember("max_rays"))
+        config.max_rays = (long long) config_data["max_rays"].GetUint64();
+    if (config_data.HasMember("max_ray_steps"))
+        config.max_ray_steps = (long long) config_data["max_ray_steps"].GetUint64();
+
+    // parallelism
+    if (config_data.HasMember("num_threads"))
+        config.num_threads = (int) config_data["num_threads"].GetUint();
+
+    // dual polarity
+    if (config_data.HasMember("dual_polarity"))
+        config.dual_polarity = config_data["dual_polarity"].GetBool();
+
+    // benchmark
+    if (config_data.HasMember("benchmark_threads"))
+        config.benchmark_threads = (int) config_data["benchmark_threads"].GetUint();
+    if (config_data.HasMember("benchmark_ccl_megapixels"))
+        config.benchmark_ccl_megapixels = (int) config_data["benchmark_ccl_megapixels"].GetUint();
+
     //=============================================================================
     // Load input images
     //=============================================================================
@@ -436,8 +796,25 @@ void execute_testcase(const rapidjson::Value &config_data)
     //=============================================================================
     // Starting default task
     //=============================================================================
-    std::cout << "Starting MAIN Task..." << std::endl;
-    run(img, output_directory, ref_directory, config);
+    if (config.num_threads > 0)
+        cv::setNumThreads(config.num_threads);
+
+    // an exceeded SWT budget only fails this testcase, the others still run
+    try
+    {
+        std::cout << "Starting MAIN Task..." << std::endl;
+        run(img, output_directory, ref_directory, config);
+
+        if (config.benchmark_threads > 0)
+        {
+            std::cout << "Starting BENCHMARK..." << std::endl;
+            run_benchmark(img, config);
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cout << BOLD(FRED("[ERROR]")) << " Testcase " << name << " failed: " << e.what() << std::endl;
+    }
 }
 
 //===============================================================================